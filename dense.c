@@ -0,0 +1,42 @@
+#include <stddef.h>
+
+#include "dense.h"
+
+void dense_interpolate(const double* r0, const double* v0, const double* a0,
+                       const double* r1, const double* v1, const double* a1,
+                       double h, double s, double* r, double* v)
+{
+    double s2 = s * s, s3 = s2 * s, s4 = s3 * s, s5 = s4 * s;
+    if (!a0 || !a1) {
+        double h00 = 2 * s3 - 3 * s2 + 1, h10 = s3 - 2 * s2 + s;
+        double h01 = -2 * s3 + 3 * s2, h11 = s3 - s2;
+        double d00 = 6 * s2 - 6 * s, d10 = 3 * s2 - 4 * s + 1;
+        double d01 = -6 * s2 + 6 * s, d11 = 3 * s2 - 2 * s;
+        for (int k = 0; k < 3; k++) {
+            r[k] = h00 * r0[k] + h10 * h * v0[k] + h01 * r1[k] + h11 * h * v1[k];
+            v[k] = (d00 * r0[k] + d01 * r1[k]) / h + d10 * v0[k] + d11 * v1[k];
+        }
+        return;
+    }
+
+    double H0 = 1 - 10 * s3 + 15 * s4 - 6 * s5;
+    double H1 = s - 6 * s3 + 8 * s4 - 3 * s5;
+    double H2 = 0.5 * s2 - 1.5 * s3 + 1.5 * s4 - 0.5 * s5;
+    double H3 = 0.5 * s3 - s4 + 0.5 * s5;
+    double H4 = -4 * s3 + 7 * s4 - 3 * s5;
+    double H5 = 10 * s3 - 15 * s4 + 6 * s5;
+
+    double D0 = -30 * s2 + 60 * s3 - 30 * s4;
+    double D1 = 1 - 18 * s2 + 32 * s3 - 15 * s4;
+    double D2 = s - 4.5 * s2 + 6 * s3 - 2.5 * s4;
+    double D3 = 1.5 * s2 - 4 * s3 + 2.5 * s4;
+    double D4 = -12 * s2 + 28 * s3 - 15 * s4;
+    double D5 = 30 * s2 - 60 * s3 + 30 * s4;
+
+    for (int k = 0; k < 3; k++) {
+        r[k] = H0 * r0[k] + H1 * h * v0[k] + H2 * h * h * a0[k]
+             + H3 * h * h * a1[k] + H4 * h * v1[k] + H5 * r1[k];
+        v[k] = (D0 * r0[k] + D5 * r1[k]) / h + D1 * v0[k] + D4 * v1[k]
+             + (D2 * a0[k] + D3 * a1[k]) * h;
+    }
+}
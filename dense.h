@@ -0,0 +1,11 @@
+#pragma once
+
+/*
+  Dense output: the state inside a step of length h at s in [0, 1] from
+  the states at its ends. With accelerations the interpolant is the
+  quintic Hermite one (error O(h^6) in r), without them (a0 = a1 = NULL)
+  the cubic one (O(h^4)).
+ */
+void dense_interpolate(const double* r0, const double* v0, const double* a0,
+                       const double* r1, const double* v1, const double* a1,
+                       double h, double s, double* r, double* v);
@@ -2,6 +2,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+
+#include "traj.h"
+#include "ic.h"
+#include "events.h"
+#include "dense.h"
 
 struct body {
     char name[16];
@@ -17,34 +23,107 @@ struct data {
     struct body* bodies;
     double G;
     double dt;
-};
 
-void euler_next(struct data* data) {
-    int n = data->nbodies;
-    double G = data->G;
-    double dt = data->dt;
+    struct traj_writer* traj;
+    double* traj_buf;
+    struct events* events;
 
-    for (int i = 0; i < n; i++) {
-        struct body* b1 = &data->bodies[i];
-        if (b1->fixed) continue;
+    // frames every output_every-th step, or at multiples of output_dt
+    int output_every;
+    double output_dt;
+    long output_n;
+    long step;
+    double* dense;  // r, v of every body at the start of the step, then at its end
 
-        for (int k = 0; k < 3; k++) {
-            b1->a[k] = 0;
-        }
+    int threads;
+    double* acc;    // 3 per body and thread, see euler_next()
+};
 
-        for (int j = 0; j < n; j++) {
-            if (i == j) continue;
+/*
+  Every pair once, equal and opposite. The pairs are cut into TILE x TILE
+  tiles, tile k goes to thread k % nthreads, every thread sums into its own
+  accumulator and these are added in thread order, so the result does not
+  depend on the schedule.
+ */
+#define TILE 256
+
+struct pass {
+    struct data* data;
+    double* acc;
+    int id;
+    int nthreads;
+};
 
+static void pair_tile(struct data* data, double* acc, int i0, int i1, int j0, int j1) {
+    double G = data->G;
+    for (int i = i0; i < i1; i++) {
+        struct body* b1 = &data->bodies[i];
+        for (int j = j0 > i ? j0 : i + 1; j < j1; j++) {
             struct body* b2 = &data->bodies[j];
 
             double R = 0;
             for (int k = 0; k < 3; k++) {
                 R += (b1->r[k] - b2->r[k]) * (b1->r[k] - b2->r[k]);
             }
-            R = sqrt(R);
+            double f = G / (R * sqrt(R));
 
             for (int k = 0; k < 3; k++) {
-                b1->a[k] += G * b2->m * (b2->r[k] - b1->r[k]) / R / R / R;
+                double d = b2->r[k] - b1->r[k];
+                acc[3 * i + k] += f * b2->m * d;
+                acc[3 * j + k] -= f * b1->m * d;
+            }
+        }
+    }
+}
+
+static void* pass_run(void* arg) {
+    struct pass* w = arg;
+    int n = w->data->nbodies;
+    int ntiles = (n + TILE - 1) / TILE;
+
+    memset(w->acc, 0, 3 * n * sizeof(double));
+    int k = 0;
+    for (int I = 0; I < ntiles; I++) {
+        for (int J = I; J < ntiles; J++, k++) {
+            if (k % w->nthreads == w->id) {
+                pair_tile(w->data, w->acc, I * TILE, I * TILE + TILE < n ? I * TILE + TILE : n,
+                          J * TILE, J * TILE + TILE < n ? J * TILE + TILE : n);
+            }
+        }
+    }
+    return NULL;
+}
+
+void euler_next(struct data* data) {
+    int n = data->nbodies;
+    double dt = data->dt;
+    // threads are started every step, below a million pairs that costs more than it saves
+    int nthreads = data->threads > 1 && (double)n * n > 2e6 ? data->threads : 1;
+
+    if (!data->acc) {
+        data->acc = malloc((3 * (size_t)n * (data->threads > 1 ? data->threads : 1) + 1) * sizeof(double));
+    }
+    pthread_t threads[nthreads];
+    struct pass w[nthreads];
+    for (int t = 0; t < nthreads; t++) {
+        w[t] = (struct pass){.data = data, .acc = &data->acc[3 * n * t], .id = t, .nthreads = nthreads};
+    }
+    for (int t = 1; t < nthreads; t++) {
+        pthread_create(&threads[t], NULL, pass_run, &w[t]);
+    }
+    pass_run(&w[0]);
+    for (int t = 1; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct body* b = &data->bodies[i];
+        if (b->fixed) continue;
+
+        for (int k = 0; k < 3; k++) {
+            b->a[k] = 0;
+            for (int t = 0; t < nthreads; t++) {
+                b->a[k] += data->acc[3 * n * t + 3 * i + k];
             }
         }
     }
@@ -107,6 +186,46 @@ double kepler(double dt) {
 
 	t += dt;
     }
+    free(data.acc);
+    return max_err;
+}
+
+// threaded pair pass against the plain sum over ordered pairs
+double pair_check(int nthreads) {
+    int n = 1500;
+    struct body* bodies = calloc(n, sizeof(struct body));
+    unsigned seed = 7;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            bodies[i].r[k] = (double)rand_r(&seed) / RAND_MAX - 0.5;
+        }
+        bodies[i].m = 1 + 0.1 * (i % 7);
+        bodies[i].fixed = i % 11 == 0;
+    }
+    // dt = 0 leaves the positions alone
+    struct data data = {.nbodies = n, .bodies = bodies, .G = 1, .threads = nthreads};
+    euler_next(&data);
+
+    double max_err = 0;
+    for (int i = 0; i < n; i++) {
+        struct body* b1 = &bodies[i];
+        double a[3] = {0, 0, 0};
+        for (int j = 0; j < n && !b1->fixed; j++) {
+            struct body* b2 = &bodies[j];
+            if (i == j) continue;
+            double R = sqrt((b2->r[0] - b1->r[0]) * (b2->r[0] - b1->r[0])
+                + (b2->r[1] - b1->r[1]) * (b2->r[1] - b1->r[1])
+                + (b2->r[2] - b1->r[2]) * (b2->r[2] - b1->r[2]));
+            for (int k = 0; k < 3; k++) {
+                a[k] += b2->m * (b2->r[k] - b1->r[k]) / R / R / R;
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            max_err = fmax(max_err, fabs(b1->a[k] - a[k]) / (fabs(a[k]) + 1));
+        }
+    }
+    free(data.acc);
+    free(bodies);
     return max_err;
 }
 
@@ -123,6 +242,14 @@ void run_test() {
         printf("Error2\n");
         exit(2);
     }
+
+    double pair1 = pair_check(1);
+    double pair3 = pair_check(3);
+    printf("%e %e\n", pair1, pair3);
+    if (pair1 > 1e-10 || pair3 > 1e-10) {
+        printf("Error3\n");
+        exit(3);
+    }
     printf("Ok\n");
     exit(0);
 }
@@ -135,9 +262,26 @@ void run_test() {
   Body2 r0 r1 r2 v0 v1 v2 Mass
   ...
   BodyN r0 r1 r2 v0 v1 v2 Mass
+  or the binary format of ic.h
  */
 
 void load(struct data* data, const char* fn) {
+    struct ic_body* src;
+    int binary = ic_read(fn, &data->G, &data->nbodies, &src);
+    if (binary < 0) {
+        goto err;
+    } else if (binary) {
+        data->bodies = calloc(data->nbodies, sizeof(struct body));
+        for (int i = 0; i < data->nbodies; i++) {
+            strcpy(data->bodies[i].name, src[i].name);
+            memcpy(data->bodies[i].r, src[i].r, sizeof(src[i].r));
+            memcpy(data->bodies[i].v, src[i].v, sizeof(src[i].v));
+            data->bodies[i].m = src[i].m;
+        }
+        free(src);
+        return;
+    }
+
     FILE* f = fopen(fn, "rb");
     if (!f) { goto err; }
 
@@ -193,19 +337,164 @@ void print(struct data* data, double t) {
     printf("\n");
 }
 
+void open_traj(struct data* data, const char* fn, double err_r, double err_v) {
+    struct traj_body* bodies = calloc(data->nbodies, sizeof(struct traj_body));
+    for (int i = 0; i < data->nbodies; i++) {
+        strcpy(bodies[i].name, data->bodies[i].name);
+        bodies[i].m = data->bodies[i].m;
+        bodies[i].rad = 1;
+    }
+    data->traj = calloc(1, sizeof(struct traj_writer));
+    if (traj_writer_open(data->traj, fn, data->nbodies, bodies, err_r, err_v, TRAJ_CHUNK_FRAMES) < 0) {
+        fprintf(stderr, "Cannot create file: '%s'\n", fn);
+        exit(1);
+    }
+    data->traj_buf = calloc(6 * data->nbodies, sizeof(double));
+    free(bodies);
+}
+
+void close_traj(struct data* data) {
+    if (data->traj) {
+        traj_writer_close(data->traj);
+        free(data->traj);
+        free(data->traj_buf);
+        data->traj = NULL;
+        data->traj_buf = NULL;
+    }
+}
+
+void open_events(struct data* data, double close, double collide, double escape) {
+    double* m = calloc(data->nbodies, sizeof(double));
+    char (*names)[16] = calloc(data->nbodies, 16);
+    for (int i = 0; i < data->nbodies; i++) {
+        m[i] = data->bodies[i].m;
+        strcpy(names[i], data->bodies[i].name);
+    }
+    data->events = calloc(1, sizeof(struct events));
+    events_init(data->events, stdout, data->nbodies, m);
+    data->events->close = close;
+    data->events->collide = collide;
+    data->events->escape = escape;
+    events_header(data->events, names);
+    if (!data->traj_buf) {
+        data->traj_buf = calloc(6 * data->nbodies, sizeof(double));
+    }
+    free(m);
+    free(names);
+}
+
+void close_events(struct data* data) {
+    if (data->events) {
+        fprintf(stderr, "events: %ld\n", data->events->count);
+        events_free(data->events);
+        free(data->events);
+        data->events = NULL;
+        if (!data->traj) {
+            free(data->traj_buf);
+            data->traj_buf = NULL;
+        }
+    }
+}
+
+void output(struct data* data, double t) {
+    if (!data->traj) {
+        print(data, t);
+        return;
+    }
+    double* rv = data->traj_buf;
+    for (int i = 0; i < data->nbodies; i++) {
+        for (int k = 0; k < 3; k++) {
+            rv[6*i+k] = data->bodies[i].r[k];
+            rv[6*i+3+k] = data->bodies[i].v[k];
+        }
+    }
+    traj_write_frame(data->traj, t, rv);
+}
+
+// events see every step, whatever the frame schedule is
+void observe(struct data* data, double t) {
+    double* rv = data->traj_buf;
+    for (int i = 0; i < data->nbodies; i++) {
+        for (int k = 0; k < 3; k++) {
+            rv[6*i+k] = data->bodies[i].r[k];
+            rv[6*i+3+k] = data->bodies[i].v[k];
+        }
+    }
+    events_step(data->events, t, rv);
+}
+
+void save_step(struct data* data) {
+    for (int i = 0; i < data->nbodies; i++) {
+        memcpy(&data->dense[6 * i], data->bodies[i].r, 3 * sizeof(double));
+        memcpy(&data->dense[6 * i + 3], data->bodies[i].v, 3 * sizeof(double));
+    }
+}
+
+// frame at tau inside the step that ended at t, cubic in r and v
+void dense_output(struct data* data, double t, double tau) {
+    double h = data->dt;
+    double s = 1 - (t - tau) / h;
+    double* end = &data->dense[6 * data->nbodies];
+    for (int i = 0; i < data->nbodies; i++) {
+        struct body* b = &data->bodies[i];
+        double* d = &data->dense[6 * i];
+        double* e = &end[6 * i];
+        memcpy(e, b->r, 3 * sizeof(double));
+        memcpy(e + 3, b->v, 3 * sizeof(double));
+        dense_interpolate(d, d + 3, NULL, e, e + 3, NULL, h, s, b->r, b->v);
+    }
+    output(data, tau);
+    for (int i = 0; i < data->nbodies; i++) {
+        memcpy(data->bodies[i].r, &end[6 * i], 3 * sizeof(double));
+        memcpy(data->bodies[i].v, &end[6 * i + 3], 3 * sizeof(double));
+    }
+}
+
+void schedule(struct data* data, double t) {
+    if (data->output_dt > 0) {
+        while ((data->output_n + 1) * data->output_dt <= t) {
+            data->output_n++;
+            dense_output(data, t, data->output_n * data->output_dt);
+        }
+    } else if (data->output_every > 0 && ++data->step % data->output_every == 0) {
+        output(data, t);
+    }
+}
+
 void solve(struct data* data, double T) {
     double t = 0;
-    print_header(data);
-    print(data, t);
+    int frames = data->output_every > 0 || data->output_dt > 0;
+    if (frames && !data->traj) {
+        print_header(data);
+    }
+    if (frames) {
+        output(data, t);
+    }
+    if (data->events) {
+        observe(data, t);
+    }
+    if (data->output_dt > 0) {
+        data->dense = calloc(12 * data->nbodies, sizeof(double));
+    }
     while (t < T) {
+        if (data->output_dt > 0) {
+            save_step(data);
+        }
         euler_next(data);
         t += data->dt;
-        print(data, t);
+        if (data->events) {
+            observe(data, t);
+        }
+        schedule(data, t);
     }
+    free(data->dense);
+    data->dense = NULL;
 }
 
 void usage(const char* name) {
-    fprintf(stderr, "%s --input file.txt [--dt 0.001] [--T 10] [--test]\n", name);
+    fprintf(stderr, "%s --input file.txt [--dt 0.001] [--T 10] [--traj out.nbt] [--traj-err 1e-6] [--traj-err-v 1e-6] [--test]\n"
+            "    [--events] [--events-close R] [--events-collide R] [--events-escape R]\n"
+            "    [--output-dt dt | --output-every K] [--threads T]\n", name);
     exit(0);
 }
 
@@ -214,6 +503,14 @@ int main(int argc, char** argv) {
     double dt = 0.0001;
     double T = 10.0;
     int test_mode = 0;
+    const char* traj_fn = NULL;
+    double traj_err = 1e-6;
+    double traj_err_v = -1;
+    int events = 0;
+    double events_close = 0, events_collide = 0, events_escape = 0;
+    int output_every = -1;
+    double output_dt = 0;
+    int threads = 1;
     for (int i = 1; i < argc; i++) {
         if (i < argc - 1 && !strcmp(argv[i], "--input")) {
             fn = argv[++i];
@@ -221,6 +518,26 @@ int main(int argc, char** argv) {
             dt = atof(argv[++i]);
         } else if (i < argc - 1 && !strcmp(argv[i], "--T")) {
             T = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--traj")) {
+            traj_fn = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--traj-err")) {
+            traj_err = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--traj-err-v")) {
+            traj_err_v = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--output-dt")) {
+            output_dt = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--output-every")) {
+            output_every = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--threads")) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--events")) {
+            events = 1;
+        } else if (i < argc - 1 && !strcmp(argv[i], "--events-close")) {
+            events = 1; events_close = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--events-collide")) {
+            events = 1; events_collide = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--events-escape")) {
+            events = 1; events_escape = atof(argv[++i]);
         } else if (!strcmp(argv[i], "--test")) {
             test_mode = 1;
         } else {
@@ -234,10 +551,24 @@ int main(int argc, char** argv) {
         usage(argv[0]);
     }
 
-    struct data data = {.dt = dt};
+    // with events only the frames asked for explicitly
+    if (output_every < 0) {
+        output_every = events ? 0 : 1;
+    }
+    struct data data = {.dt = dt, .output_every = output_every, .output_dt = output_dt,
+                        .threads = threads};
     load(&data, fn);
+    if (traj_fn) {
+        open_traj(&data, traj_fn, traj_err, traj_err_v > 0 ? traj_err_v : traj_err);
+    }
+    if (events) {
+        open_events(&data, events_close, events_collide, events_escape);
+    }
     solve(&data, T);
+    close_events(&data);
+    close_traj(&data);
     free(data.bodies);
+    free(data.acc);
 
     return 0;
 }
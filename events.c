@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "events.h"
+#include "dense.h"
+
+#define EVENT_BISECTIONS 60
+
+void events_init(struct events* ev, FILE* out, int nbodies, const double* m) {
+    memset(ev, 0, sizeof(*ev));
+    ev->out = out;
+    ev->nbodies = nbodies;
+    ev->m = malloc(nbodies * sizeof(double));
+    memcpy(ev->m, m, nbodies * sizeof(double));
+    ev->primary = malloc(nbodies * sizeof(int));
+    ev->last_peri = malloc(nbodies * sizeof(double));
+    for (int i = 0; i < nbodies; i++) {
+        ev->last_peri[i] = NAN;
+    }
+    ev->prev = calloc(6 * nbodies, sizeof(double));
+}
+
+void events_header(struct events* ev, char names[][16]) {
+    fprintf(ev->out, "# events: peri|apo t i j distance speed period, close|collision|escape t i j distance speed\n");
+    fprintf(ev->out, "# close %e collide %e escape %e\n", ev->close, ev->collide, ev->escape);
+    for (int i = 0; i < ev->nbodies; i++) {
+        fprintf(ev->out, "# %d %s %le\n", i, names[i], ev->m[i]);
+    }
+}
+
+void events_free(struct events* ev) {
+    free(ev->m);
+    free(ev->primary);
+    free(ev->last_peri);
+    free(ev->prev);
+}
+
+struct pair_state {
+    double d;       // separation
+    double rdot;    // d . d'
+    double speed;
+};
+
+// j < 0: the center of mass, which moves uniformly
+static struct pair_state relative(struct events* ev, const double* cm0, const double* cm1,
+                                  const double* cur, int i, int j, double h, double s)
+{
+    double ri[3], vi[3], rj[3], vj[3];
+    dense_interpolate(&ev->prev[6 * i], &ev->prev[6 * i + 3], NULL, &cur[6 * i], &cur[6 * i + 3], NULL, h, s, ri, vi);
+    if (j >= 0) {
+        dense_interpolate(&ev->prev[6 * j], &ev->prev[6 * j + 3], NULL, &cur[6 * j], &cur[6 * j + 3], NULL, h, s, rj, vj);
+    } else {
+        for (int k = 0; k < 3; k++) {
+            rj[k] = cm0[k] + s * (cm1[k] - cm0[k]);
+            vj[k] = cm0[3 + k];
+        }
+    }
+    struct pair_state p = {0, 0, 0};
+    for (int k = 0; k < 3; k++) {
+        double dr = ri[k] - rj[k], dv = vi[k] - vj[k];
+        p.d += dr * dr;
+        p.rdot += dr * dv;
+        p.speed += dv * dv;
+    }
+    p.d = sqrt(p.d);
+    p.speed = sqrt(p.speed);
+    return p;
+}
+
+enum { F_RDOT, F_COLLIDE, F_ESCAPE };
+
+static double event_f(struct pair_state p, int kind, struct events* ev) {
+    return kind == F_RDOT ? p.rdot
+        : kind == F_COLLIDE ? p.d - ev->collide
+        : p.d - ev->escape;
+}
+
+// root of the event function in the step, f changes sign between s = 0 and 1
+static double locate(struct events* ev, const double* cm0, const double* cm1, const double* cur,
+                     int i, int j, double h, int kind, struct pair_state* at)
+{
+    double lo = 0, hi = 1;
+    double flo = event_f(relative(ev, cm0, cm1, cur, i, j, h, lo), kind, ev);
+    for (int it = 0; it < EVENT_BISECTIONS; it++) {
+        double mid = 0.5 * (lo + hi);
+        double fmid = event_f(relative(ev, cm0, cm1, cur, i, j, h, mid), kind, ev);
+        if ((fmid < 0) == (flo < 0)) {
+            lo = mid;
+            flo = fmid;
+        } else {
+            hi = mid;
+        }
+    }
+    double s = 0.5 * (lo + hi);
+    *at = relative(ev, cm0, cm1, cur, i, j, h, s);
+    return s;
+}
+
+// period: NULL for the records without one
+static void emit(struct events* ev, const char* kind, double t, int i, int j, struct pair_state p, const double* period) {
+    fprintf(ev->out, "%s %.15e %d %d %.15e %.15e", kind, t, i, j, p.d, p.speed);
+    if (period) {
+        fprintf(ev->out, " %.15e", *period);
+    }
+    fprintf(ev->out, "\n");
+    ev->count++;
+}
+
+static void center_of_mass(struct events* ev, const double* rv, double* cm) {
+    double M = 0;
+    memset(cm, 0, 6 * sizeof(double));
+    for (int i = 0; i < ev->nbodies; i++) {
+        M += ev->m[i];
+        for (int k = 0; k < 6; k++) {
+            cm[k] += ev->m[i] * rv[6 * i + k];
+        }
+    }
+    for (int k = 0; k < 6; k++) {
+        cm[k] /= M;
+    }
+}
+
+static void find_primaries(struct events* ev, const double* rv) {
+    for (int i = 0; i < ev->nbodies; i++) {
+        double best = 0;
+        int old = ev->primary[i];
+        ev->primary[i] = -1;
+        for (int j = 0; j < ev->nbodies; j++) {
+            if (ev->m[j] <= ev->m[i]) continue;
+            double R = 0;
+            for (int k = 0; k < 3; k++) {
+                R += (rv[6 * i + k] - rv[6 * j + k]) * (rv[6 * i + k] - rv[6 * j + k]);
+            }
+            // tidal dominance, so the Moon goes around the Earth rather than the Sun
+            double pull = ev->m[j] / (R * sqrt(R));
+            if (pull > best) {
+                best = pull;
+                ev->primary[i] = j;
+            }
+        }
+        if (ev->primary[i] != old) {
+            ev->last_peri[i] = NAN;
+        }
+    }
+}
+
+void events_step(struct events* ev, double t, const double* rv) {
+    int n = ev->nbodies;
+    if (!ev->started) {
+        for (int i = 0; i < n; i++) {
+            ev->primary[i] = -1;
+        }
+        find_primaries(ev, rv);
+        ev->started = 1;
+        ev->t_prev = t;
+        memcpy(ev->prev, rv, 6 * n * sizeof(double));
+        return;
+    }
+    double h = t - ev->t_prev;
+    double cm0[6], cm1[6];
+    center_of_mass(ev, ev->prev, cm0);
+    center_of_mass(ev, rv, cm1);
+
+    for (int i = 0; i < n; i++) {
+        int j = ev->primary[i];
+        struct pair_state at;
+        if (j >= 0) {
+            struct pair_state a = relative(ev, cm0, cm1, rv, i, j, h, 0);
+            struct pair_state b = relative(ev, cm0, cm1, rv, i, j, h, 1);
+            int peri = a.rdot < 0 && b.rdot >= 0;
+            if (peri || (a.rdot > 0 && b.rdot <= 0)) {
+                double te = ev->t_prev + h * locate(ev, cm0, cm1, rv, i, j, h, F_RDOT, &at);
+                double period = 0;
+                if (peri) {
+                    period = isnan(ev->last_peri[i]) ? 0 : te - ev->last_peri[i];
+                    ev->last_peri[i] = te;
+                }
+                emit(ev, peri ? "peri" : "apo", te, i, j, at, &period);
+            }
+        }
+
+        if (ev->escape > 0) {
+            struct pair_state a = relative(ev, cm0, cm1, rv, i, -1, h, 0);
+            struct pair_state b = relative(ev, cm0, cm1, rv, i, -1, h, 1);
+            if (a.d <= ev->escape && b.d > ev->escape) {
+                double te = ev->t_prev + h * locate(ev, cm0, cm1, rv, i, -1, h, F_ESCAPE, &at);
+                emit(ev, "escape", te, i, -1, at, NULL);
+            }
+        }
+
+        if (ev->close <= 0 && ev->collide <= 0) continue;
+        for (int j = i + 1; j < n; j++) {
+            struct pair_state a = relative(ev, cm0, cm1, rv, i, j, h, 0);
+            struct pair_state b = relative(ev, cm0, cm1, rv, i, j, h, 1);
+            if (ev->collide > 0 && a.d >= ev->collide && b.d < ev->collide) {
+                double te = ev->t_prev + h * locate(ev, cm0, cm1, rv, i, j, h, F_COLLIDE, &at);
+                emit(ev, "collision", te, i, j, at, NULL);
+            }
+            if (ev->close > 0 && a.rdot < 0 && b.rdot >= 0 && fmin(a.d, b.d) < ev->close) {
+                double te = ev->t_prev + h * locate(ev, cm0, cm1, rv, i, j, h, F_RDOT, &at);
+                if (at.d < ev->close) {
+                    emit(ev, "close", te, i, j, at, NULL);
+                }
+            }
+        }
+    }
+
+    ev->t_prev = t;
+    memcpy(ev->prev, rv, 6 * n * sizeof(double));
+    if (++ev->steps % EVENT_PRIMARY_STEPS == 0) {
+        find_primaries(ev, rv);
+    }
+}
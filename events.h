@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+
+#define EVENT_PRIMARY_STEPS 64
+
+/*
+  Event detection on the frames of a kernel. Between two frames every body
+  follows the cubic Hermite curve through its positions and velocities,
+  events are sign changes of a function along these curves, located by
+  bisection.
+
+  records, one per line:
+    peri t i j distance speed period   periapsis of i around its primary j
+    apo t i j distance speed period    apoapsis
+    close t i j distance speed         closest approach closer than `close`
+    collision t i j distance speed     separation falls below `collide`
+    escape t i -1 distance speed       distance from the center of mass exceeds `escape`
+  period is the time since the previous periapsis, 0 for the first one.
+  Primaries are chosen again every EVENT_PRIMARY_STEPS steps, so a captured
+  or escaped body is measured against its new primary; the period starts
+  over when the primary changes.
+  Records found in the same step are ordered by body, not by time.
+ */
+
+struct events {
+    FILE* out;
+    int nbodies;
+    double* m;
+
+    // thresholds, 0 to disable
+    double close;
+    double collide;
+    double escape;
+
+    int* primary;   // heavier body with the largest m / r^3, -1 if none
+    double* last_peri;  // NAN before the first periapsis
+    long steps;
+    double* prev;   // previous frame, 6 values per body
+    double t_prev;
+    int started;
+    long count;
+};
+
+void events_init(struct events* ev, FILE* out, int nbodies, const double* m);
+// header and body names, call after the thresholds are set
+void events_header(struct events* ev, char names[][16]);
+// rv: 6 values per body, r0 r1 r2 v0 v1 v2
+void events_step(struct events* ev, double t, const double* rv);
+void events_free(struct events* ev);
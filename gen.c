@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ic.h"
+
+/*
+  Generator of initial conditions, a native replacement of saturn.py and contour.py.
+  Every random number is a hash of (seed, body, draw), so the output
+  depends on the seed only, not on the number of threads.
+ */
+
+struct gen {
+    const char* family;
+    int n;          // generated bodies
+    int ncenter;    // fixed bodies in front of them
+    uint64_t seed;
+    double G;
+    double M;       // central mass (total mass for plummer)
+    double radius;
+    double width;
+    double disk_mass;
+
+    struct ic_body* bodies;
+};
+
+struct job {
+    struct gen* gen;
+    void (*body)(struct gen* g, int i, struct ic_body* b);
+    int from, to;
+};
+
+static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// k-th uniform number in [0, 1) of body i
+static double uniform(struct gen* g, int i, int k) {
+    uint64_t x = mix(mix(g->seed + 0x9e3779b97f4a7c15ull * (uint64_t)(i + 1)) + (uint64_t)k);
+    return (x >> 11) * 0x1.0p-53;
+}
+
+static void isotropic(struct gen* g, int i, int k, double len, double* out) {
+    double z = 1 - 2 * uniform(g, i, k);
+    double phi = 2 * M_PI * uniform(g, i, k + 1);
+    double s = sqrt(1 - z * z);
+    out[0] = len * s * cos(phi);
+    out[1] = len * s * sin(phi);
+    out[2] = len * z;
+}
+
+static void init_body(struct ic_body* b, const char* name, double m) {
+    memset(b, 0, sizeof(*b));
+    snprintf(b->name, sizeof(b->name), "%s", name);
+    strcpy(b->color, "000000");
+    b->m = m;
+    b->min_rad = b->max_rad = -1;
+    b->rad = 1;
+}
+
+// circular orbit in the plane z = 0 around the central mass
+static void circular(struct gen* g, double r, double alpha, double M, struct ic_body* b) {
+    double x = r * cos(alpha);
+    double y = r * sin(alpha);
+    double v = sqrt(g->G * M / r);
+    b->r[0] = x; b->r[1] = y;
+    b->v[0] = -y / r * v; b->v[1] = x / r * v;
+}
+
+static void ring_body(struct gen* g, int i, struct ic_body* b) {
+    char name[16];
+    snprintf(name, sizeof(name), "B%d", i);
+    init_body(b, name, 1.0 / g->n);
+    double alpha = 2 * M_PI * uniform(g, i, 0);
+    double r = g->radius + (uniform(g, i, 1) - 0.5) * g->width;
+    circular(g, r, alpha, g->M, b);
+}
+
+// two rings as in saturn.py
+static void saturn_body(struct gen* g, int i, struct ic_body* b) {
+    int half = (g->n + 1) / 2;
+    int outer = i >= half;
+    char name[16];
+    snprintf(name, sizeof(name), outer ? "BB%d" : "B%d", outer ? i - half : i);
+    init_body(b, name, 1.0 / half);
+    double alpha = 2 * M_PI * uniform(g, i, 0);
+    double r = (outer ? 1.3 : 1.0) * g->radius + (uniform(g, i, 1) - 0.5) * g->width;
+    circular(g, r, alpha, g->M, b);
+}
+
+// bodies at rest on a spherical shell, as in contour.py
+static void shell_body(struct gen* g, int i, struct ic_body* b) {
+    char name[16];
+    snprintf(name, sizeof(name), "B%d", i);
+    init_body(b, name, 1.0);
+    double r = g->radius + (uniform(g, i, 0) - 0.5) * g->width;
+    isotropic(g, i, 1, r, b->r);
+    if (g->ncenter > 0) {
+        b->min_rad = 0.8; b->max_rad = 1.2;
+    }
+}
+
+// Aarseth, Henon, Wielen (1974), scale radius g->radius
+static void plummer_body(struct gen* g, int i, struct ic_body* b) {
+    char name[16];
+    snprintf(name, sizeof(name), "B%d", i);
+    init_body(b, name, g->M / g->n);
+    double a = g->radius;
+    double r;
+    int k = 0;
+    do {
+        double x = uniform(g, i, k++);
+        r = x > 0 ? a / sqrt(pow(x, -2.0 / 3.0) - 1) : INFINITY;
+    } while (r > 10 * a);
+    isotropic(g, i, k, r, b->r);
+    k += 2;
+
+    double q, y;
+    do {
+        q = uniform(g, i, k++);
+        y = 0.1 * uniform(g, i, k++);
+    } while (y > q * q * pow(1 - q * q, 3.5));
+    double ve = sqrt(2 * g->G * g->M / a) * pow(1 + r * r / a / a, -0.25);
+    isotropic(g, i, k, q * ve, b->v);
+}
+
+// exponential disk of scale length g->radius around the central mass
+static void disk_body(struct gen* g, int i, struct ic_body* b) {
+    char name[16];
+    snprintf(name, sizeof(name), "B%d", i);
+    init_body(b, name, g->disk_mass / g->n);
+    double h = g->radius;
+    double r;
+    int k = 0;
+    do {
+        // surface density ~ exp(-r/h): r/h is gamma(2) distributed
+        r = -h * log((1 - uniform(g, i, k)) * (1 - uniform(g, i, k + 1)));
+        k += 2;
+    } while (r < 0.1 * h);
+    double x = r / h;
+    double inner = g->M + g->disk_mass * (1 - exp(-x) * (1 + x));
+    circular(g, r, 2 * M_PI * uniform(g, i, k), inner, b);
+    b->r[2] = g->width * (uniform(g, i, k + 1) - 0.5);
+}
+
+static void* worker(void* arg) {
+    struct job* job = arg;
+    struct gen* g = job->gen;
+    for (int i = job->from; i < job->to; i++) {
+        job->body(g, i, &g->bodies[g->ncenter + i]);
+    }
+    return NULL;
+}
+
+static void center(struct gen* g, int k, const char* name, double m, double x, double y, double z) {
+    struct ic_body* b = &g->bodies[k];
+    init_body(b, name, m);
+    b->r[0] = x; b->r[1] = y; b->r[2] = z;
+}
+
+// moves the generated bodies to their center of mass frame, in index order
+static void to_com(struct gen* g) {
+    double m = 0, r[3] = {0}, v[3] = {0};
+    for (int i = g->ncenter; i < g->ncenter + g->n; i++) {
+        struct ic_body* b = &g->bodies[i];
+        m += b->m;
+        for (int k = 0; k < 3; k++) {
+            r[k] += b->m * b->r[k];
+            v[k] += b->m * b->v[k];
+        }
+    }
+    for (int i = g->ncenter; i < g->ncenter + g->n; i++) {
+        for (int k = 0; k < 3; k++) {
+            g->bodies[i].r[k] -= r[k] / m;
+            g->bodies[i].v[k] -= v[k] / m;
+        }
+    }
+}
+
+void generate(struct gen* g, int nthreads) {
+    void (*body)(struct gen* g, int i, struct ic_body* b) = NULL;
+    g->ncenter = 0;
+    if (!strcmp(g->family, "ring") || !strcmp(g->family, "saturn") || !strcmp(g->family, "disk")) {
+        g->ncenter = 1;
+        body = !strcmp(g->family, "ring") ? ring_body
+            : !strcmp(g->family, "saturn") ? saturn_body
+            : disk_body;
+    } else if (!strcmp(g->family, "contour")) {
+        g->ncenter = 4;
+        body = shell_body;
+    } else if (!strcmp(g->family, "shell")) {
+        body = shell_body;
+    } else if (!strcmp(g->family, "plummer")) {
+        body = plummer_body;
+    } else {
+        fprintf(stderr, "Unknown family: '%s'\n", g->family);
+        exit(1);
+    }
+
+    g->bodies = calloc(g->ncenter + g->n, sizeof(struct ic_body));
+    if (!strcmp(g->family, "contour")) {
+        center(g, 0, "C1", 10, 0, 0, 0);
+        center(g, 1, "C2", 1, 0, 0.1, 0);
+        center(g, 2, "C3", 1, 0.1, 0, 0);
+        center(g, 3, "C4", 1, 0, 0, 0.1);
+        const char* colors[] = {"00ff00", "0000ff", "ff00ff", "00ffff"};
+        for (int k = 0; k < 4; k++) {
+            strcpy(g->bodies[k].color, colors[k]);
+            g->bodies[k].max_rad = 0.8;
+            g->bodies[k].rad = k == 0 ? 2.5 : 2;
+        }
+    } else if (g->ncenter) {
+        center(g, 0, !strcmp(g->family, "saturn") ? "Saturn" : "Center", g->M, 0, 0, 0);
+    }
+
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    pthread_t* threads = calloc(nthreads, sizeof(pthread_t));
+    struct job* jobs = calloc(nthreads, sizeof(struct job));
+    for (int t = 0; t < nthreads; t++) {
+        jobs[t].gen = g;
+        jobs[t].body = body;
+        jobs[t].from = (long)g->n * t / nthreads;
+        jobs[t].to = (long)g->n * (t + 1) / nthreads;
+        pthread_create(&threads[t], NULL, worker, &jobs[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(jobs);
+
+    if (body == plummer_body) {
+        to_com(g);
+    }
+}
+
+void write_text(FILE* f, struct gen* g) {
+    int n = g->ncenter + g->n;
+    fprintf(f, "%.16e\n%d\n", g->G, n);
+    for (int i = 0; i < n; i++) {
+        struct ic_body* b = &g->bodies[i];
+        fprintf(f, "%s %.16e %.16e %.16e %.16e %.16e %.16e %.16e\n",
+            b->name, b->r[0], b->r[1], b->r[2], b->v[0], b->v[1], b->v[2], b->m);
+    }
+    for (int i = 0; i < n; i++) {
+        struct ic_body* b = &g->bodies[i];
+        if (strcmp(b->color, "000000") || b->min_rad != -1 || b->max_rad != -1 || b->rad != 1) {
+            fprintf(f, "%d %s %f %f %f\n", i, b->color, b->min_rad, b->max_rad, b->rad);
+        }
+    }
+}
+
+double virial(struct gen* g) {
+    int n = g->ncenter + g->n;
+    double T = 0, W = 0;
+    for (int i = 0; i < n; i++) {
+        struct ic_body* b = &g->bodies[i];
+        T += 0.5 * b->m * (b->v[0] * b->v[0] + b->v[1] * b->v[1] + b->v[2] * b->v[2]);
+        for (int j = i + 1; j < n; j++) {
+            struct ic_body* c = &g->bodies[j];
+            double dx = b->r[0] - c->r[0], dy = b->r[1] - c->r[1], dz = b->r[2] - c->r[2];
+            W -= g->G * b->m * c->m / sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    }
+    return -2 * T / W;
+}
+
+void run_test() {
+    // the same bodies for any number of threads
+    struct gen g1 = {.family = "plummer", .n = 3000, .seed = 42, .G = 1, .M = 1, .radius = 1};
+    struct gen g4 = g1;
+    clock_t start = clock();
+    generate(&g1, 1);
+    generate(&g4, 4);
+    double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+    double q = virial(&g1);
+
+    // rings are on circular orbits
+    struct gen ring = {.family = "ring", .n = 1000, .seed = 1, .G = 1, .M = 1e5, .radius = 1, .width = 0.2};
+    generate(&ring, 3);
+    double err = 0;
+    for (int i = 1; i <= ring.n; i++) {
+        struct ic_body* b = &ring.bodies[i];
+        double r = sqrt(b->r[0] * b->r[0] + b->r[1] * b->r[1]);
+        double v2 = b->v[0] * b->v[0] + b->v[1] * b->v[1];
+        err = fmax(err, fabs(v2 * r / ring.G / ring.M - 1));
+    }
+
+    // binary round trip
+    char fn[] = "/tmp/gen_test_XXXXXX";
+    int fd = mkstemp(fn);
+    if (fd < 0) {
+        printf("Cannot create temporary file\n");
+        exit(1);
+    }
+    close(fd);
+    double G;
+    int n;
+    struct ic_body* back = NULL;
+    int same = ic_write(fn, g1.G, g1.n, g1.bodies) == 0
+        && ic_read(fn, &G, &n, &back) == 1
+        && G == g1.G && n == g1.n
+        && !memcmp(back, g1.bodies, n * sizeof(struct ic_body));
+    remove(fn);
+
+    printf("%f %e %f\n", q, err, sec);
+    if (memcmp(g1.bodies, g4.bodies, g1.n * sizeof(struct ic_body))) {
+        printf("Error1\n");
+        exit(1);
+    }
+    if (fabs(q - 1) > 0.1) {
+        printf("Error2\n");
+        exit(2);
+    }
+    if (err > 1e-12) {
+        printf("Error3\n");
+        exit(3);
+    }
+    if (!same) {
+        printf("Error4\n");
+        exit(4);
+    }
+    printf("Ok\n");
+    exit(0);
+}
+
+void usage(const char* name) {
+    fprintf(stderr, "%s [--family ring|saturn|shell|contour|plummer|disk] [--n N] [--seed S] [--threads T]\n"
+            "    [--G G] [--mass M] [--radius R] [--width W] [--disk-mass M]\n"
+            "    [--out file] [--binary] [--test]\n"
+            "  --out file.nbi writes the binary format, anything else the text one\n", name);
+    exit(0);
+}
+
+int main(int argc, char** argv) {
+    struct gen g = {.family = "saturn", .n = 1998, .seed = 1, .radius = 1};
+    double G = NAN, M = NAN, width = NAN;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* out = NULL;
+    int binary = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i < argc - 1 && !strcmp(argv[i], "--family")) {
+            g.family = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--n")) {
+            g.n = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--seed")) {
+            g.seed = strtoull(argv[++i], NULL, 10);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--threads")) {
+            nthreads = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--G")) {
+            G = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--mass")) {
+            M = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--radius")) {
+            g.radius = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--width")) {
+            width = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--disk-mass")) {
+            g.disk_mass = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--out")) {
+            out = argv[++i];
+        } else if (!strcmp(argv[i], "--binary")) {
+            binary = 1;
+        } else if (!strcmp(argv[i], "--test")) {
+            run_test(); return 0;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (g.n <= 0) {
+        usage(argv[0]);
+    }
+
+    // defaults of the families
+    int saturn = !strcmp(g.family, "saturn") || !strcmp(g.family, "ring");
+    g.G = !isnan(G) ? G : !strcmp(g.family, "contour") ? -1 : 1;
+    g.M = !isnan(M) ? M : saturn ? 18666666.666666668 : 1;
+    g.width = !isnan(width) ? width : !strcmp(g.family, "disk") ? 0.02 * g.radius : 0.2 * g.radius;
+    if (g.disk_mass == 0) {
+        g.disk_mass = 0.1 * g.M;
+    }
+
+    generate(&g, nthreads);
+
+    size_t len = out ? strlen(out) : 0;
+    if (out && (binary || (len > 4 && !strcmp(out + len - 4, ".nbi")))) {
+        if (ic_write(out, g.G, g.ncenter + g.n, g.bodies) < 0) {
+            fprintf(stderr, "Cannot write file: '%s'\n", out);
+            exit(1);
+        }
+    } else {
+        FILE* f = out ? fopen(out, "wb") : stdout;
+        if (!f) {
+            fprintf(stderr, "Cannot write file: '%s'\n", out);
+            exit(1);
+        }
+        write_text(f, &g);
+        if (out) {
+            fclose(f);
+        }
+    }
+    free(g.bodies);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ic.h"
+
+#define IC_MAGIC "NBINIT1\n"
+#define IC_VERSION 1
+#define IC_HEADER_SIZE 24
+#define IC_BODY_SIZE 104
+// bodies per buffered block
+#define IC_BLOCK 4096
+
+static void put_u32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+static void put_f64(uint8_t* p, double v) { memcpy(p, &v, 8); }
+static uint32_t get_u32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static double get_f64(const uint8_t* p) { double v; memcpy(&v, p, 8); return v; }
+
+static void put_body(uint8_t* p, const struct ic_body* b) {
+    memset(p, 0, IC_BODY_SIZE);
+    strncpy((char*)p, b->name, 15);
+    for (int k = 0; k < 3; k++) {
+        put_f64(p + 16 + 8 * k, b->r[k]);
+        put_f64(p + 40 + 8 * k, b->v[k]);
+    }
+    put_f64(p + 64, b->m);
+    strncpy((char*)p + 72, b->color, 7);
+    put_f64(p + 80, b->min_rad);
+    put_f64(p + 88, b->max_rad);
+    put_f64(p + 96, b->rad);
+}
+
+static void get_body(const uint8_t* p, struct ic_body* b) {
+    memcpy(b->name, p, 16);
+    b->name[15] = 0;
+    for (int k = 0; k < 3; k++) {
+        b->r[k] = get_f64(p + 16 + 8 * k);
+        b->v[k] = get_f64(p + 40 + 8 * k);
+    }
+    b->m = get_f64(p + 64);
+    memcpy(b->color, p + 72, 8);
+    b->color[7] = 0;
+    b->min_rad = get_f64(p + 80);
+    b->max_rad = get_f64(p + 88);
+    b->rad = get_f64(p + 96);
+}
+
+int ic_write(const char* fn, double G, int nbodies, const struct ic_body* bodies) {
+    FILE* f = fopen(fn, "wb");
+    if (!f) {
+        return -1;
+    }
+    uint8_t* buf = malloc(IC_BLOCK * IC_BODY_SIZE);
+    memcpy(buf, IC_MAGIC, 8);
+    put_u32(buf + 8, IC_VERSION);
+    put_u32(buf + 12, nbodies);
+    put_f64(buf + 16, G);
+    int ok = fwrite(buf, IC_HEADER_SIZE, 1, f) == 1;
+    for (int i = 0; ok && i < nbodies; i += IC_BLOCK) {
+        int n = nbodies - i < IC_BLOCK ? nbodies - i : IC_BLOCK;
+        for (int j = 0; j < n; j++) {
+            put_body(buf + j * IC_BODY_SIZE, &bodies[i + j]);
+        }
+        ok = fwrite(buf, IC_BODY_SIZE, n, f) == n;
+    }
+    free(buf);
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+int ic_read(const char* fn, double* G, int* nbodies, struct ic_body** bodies) {
+    uint8_t header[IC_HEADER_SIZE];
+    FILE* f = fopen(fn, "rb");
+    if (!f) {
+        return -1;
+    }
+    if (fread(header, IC_HEADER_SIZE, 1, f) != 1 || memcmp(header, IC_MAGIC, 8)) {
+        fclose(f);
+        return 0;
+    }
+    if (get_u32(header + 8) != IC_VERSION || (int)get_u32(header + 12) < 0) {
+        fclose(f);
+        return -1;
+    }
+    int n = get_u32(header + 12);
+    *G = get_f64(header + 16);
+    struct ic_body* b = calloc(n ? n : 1, sizeof(struct ic_body));
+    uint8_t* buf = malloc(IC_BLOCK * IC_BODY_SIZE);
+    int ok = 1;
+    for (int i = 0; ok && i < n; i += IC_BLOCK) {
+        int m = n - i < IC_BLOCK ? n - i : IC_BLOCK;
+        ok = fread(buf, IC_BODY_SIZE, m, f) == m;
+        for (int j = 0; ok && j < m; j++) {
+            get_body(buf + j * IC_BODY_SIZE, &b[i + j]);
+        }
+    }
+    free(buf);
+    fclose(f);
+    if (!ok) {
+        free(b);
+        return -1;
+    }
+    *nbodies = n;
+    *bodies = b;
+    return 1;
+}
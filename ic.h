@@ -0,0 +1,29 @@
+#pragma once
+
+/*
+  Binary initial conditions (.nbi), an alternative to the text input of the kernels.
+
+  header:
+    "NBINIT1\n" u32 version, u32 nbodies, f64 G
+  bodies:
+    nbodies x { char name[16], f64 r[3], f64 v[3], f64 m,
+                char color[8], f64 min_rad, f64 max_rad, f64 rad }
+
+  All numbers are little endian. min_rad = max_rad = -1 and rad = 1
+  mean the same as a body without a property line in the text format.
+ */
+
+struct ic_body {
+    char name[16];
+    double r[3];
+    double v[3];
+    double m;
+    char color[8];
+    double min_rad;
+    double max_rad;
+    double rad;
+};
+
+int ic_write(const char* fn, double G, int nbodies, const struct ic_body* bodies);
+// 1 if fn is a binary file (bodies are allocated with malloc), 0 if it is not, -1 on error
+int ic_read(const char* fn, double* G, int* nbodies, struct ic_body** bodies);
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "traj.h"
+#include "scene.h"
+
+/*
+  Headless renderer: draws a kernel stream (stdin) or a trajectory archive
+  with the drawing code of the GUI into image surfaces and writes PNG/PPM
+  frames. Rendering is sequential (trails depend on the previous frame),
+  encoding runs on a pool of threads.
+ */
+
+struct job {
+    cairo_surface_t* surface;
+    long index;
+};
+
+struct encoder {
+    pthread_mutex_t lock;
+    pthread_cond_t has_job;
+    pthread_cond_t has_surface;
+
+    pthread_t* threads;
+    int nthreads;
+
+    // ring of rendered frames waiting for a worker
+    struct job* jobs;
+    int head;
+    int count;
+
+    // surfaces nobody uses right now
+    cairo_surface_t** spare;
+    int nspare;
+    int nsurfaces;
+
+    int done;
+    int failed;
+
+    const char* prefix;
+    int ppm;
+};
+
+struct renderer {
+    int nbodies;
+    struct body* bodies;
+    struct trails trails;
+
+    int width;
+    int height;
+    double zoom;
+    long every;
+    long nframes;
+    long nrendered;
+
+    struct encoder enc;
+};
+
+int write_ppm(cairo_surface_t* surface, const char* fn) {
+    FILE* f = fopen(fn, "wb");
+    if (!f) {
+        return -1;
+    }
+    int w = cairo_image_surface_get_width(surface);
+    int h = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    const unsigned char* data = cairo_image_surface_get_data(surface);
+    unsigned char* row = malloc(3 * w);
+    fprintf(f, "P6\n%d %d\n255\n", w, h);
+    for (int y = 0; y < h; y++) {
+        const uint32_t* p = (const uint32_t*)(data + y * stride);
+        for (int x = 0; x < w; x++) {
+            row[3*x+0] = (p[x] >> 16) & 0xff;
+            row[3*x+1] = (p[x] >> 8) & 0xff;
+            row[3*x+2] = p[x] & 0xff;
+        }
+        fwrite(row, 1, 3 * w, f);
+    }
+    free(row);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void* encode_thread(void* arg) {
+    struct encoder* enc = arg;
+    char fn[1024];
+    for (;;) {
+        pthread_mutex_lock(&enc->lock);
+        while (enc->count == 0 && !enc->done) {
+            pthread_cond_wait(&enc->has_job, &enc->lock);
+        }
+        if (enc->count == 0) {
+            pthread_mutex_unlock(&enc->lock);
+            return NULL;
+        }
+        struct job job = enc->jobs[enc->head];
+        enc->head = (enc->head + 1) % enc->nsurfaces;
+        enc->count--;
+        pthread_mutex_unlock(&enc->lock);
+
+        int ret;
+        if (enc->ppm) {
+            snprintf(fn, sizeof(fn), "%s%06ld.ppm", enc->prefix, job.index);
+            ret = write_ppm(job.surface, fn);
+        } else {
+            snprintf(fn, sizeof(fn), "%s%06ld.png", enc->prefix, job.index);
+            ret = cairo_surface_write_to_png(job.surface, fn) == CAIRO_STATUS_SUCCESS ? 0 : -1;
+        }
+
+        pthread_mutex_lock(&enc->lock);
+        if (ret < 0 && !enc->failed) {
+            fprintf(stderr, "Cannot write file: '%s'\n", fn);
+            enc->failed = 1;
+        }
+        enc->spare[enc->nspare++] = job.surface;
+        pthread_cond_signal(&enc->has_surface);
+        pthread_mutex_unlock(&enc->lock);
+    }
+}
+
+void encoder_start(struct encoder* enc, int nthreads, int w, int h) {
+    pthread_mutex_init(&enc->lock, NULL);
+    pthread_cond_init(&enc->has_job, NULL);
+    pthread_cond_init(&enc->has_surface, NULL);
+    enc->nthreads = nthreads;
+    // two frames per worker: one being encoded, one waiting
+    enc->nsurfaces = 2 * nthreads;
+    enc->jobs = calloc(enc->nsurfaces, sizeof(struct job));
+    enc->spare = calloc(enc->nsurfaces, sizeof(cairo_surface_t*));
+    for (int i = 0; i < enc->nsurfaces; i++) {
+        enc->spare[enc->nspare++] = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
+    }
+    enc->threads = calloc(nthreads, sizeof(pthread_t));
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&enc->threads[i], NULL, encode_thread, enc);
+    }
+}
+
+cairo_surface_t* encoder_get_surface(struct encoder* enc) {
+    pthread_mutex_lock(&enc->lock);
+    while (enc->nspare == 0) {
+        pthread_cond_wait(&enc->has_surface, &enc->lock);
+    }
+    cairo_surface_t* surface = enc->spare[--enc->nspare];
+    pthread_mutex_unlock(&enc->lock);
+    return surface;
+}
+
+void encoder_submit(struct encoder* enc, cairo_surface_t* surface, long index) {
+    pthread_mutex_lock(&enc->lock);
+    struct job* job = &enc->jobs[(enc->head + enc->count) % enc->nsurfaces];
+    job->surface = surface;
+    job->index = index;
+    enc->count++;
+    pthread_cond_signal(&enc->has_job);
+    pthread_mutex_unlock(&enc->lock);
+}
+
+int encoder_finish(struct encoder* enc) {
+    pthread_mutex_lock(&enc->lock);
+    enc->done = 1;
+    pthread_cond_broadcast(&enc->has_job);
+    pthread_mutex_unlock(&enc->lock);
+    for (int i = 0; i < enc->nthreads; i++) {
+        pthread_join(enc->threads[i], NULL);
+    }
+    for (int i = 0; i < enc->nspare; i++) {
+        cairo_surface_destroy(enc->spare[i]);
+    }
+    free(enc->threads);
+    free(enc->jobs);
+    free(enc->spare);
+    return enc->failed ? -1 : 0;
+}
+
+void render_frame(struct renderer* r) {
+    cairo_surface_t* surface = encoder_get_surface(&r->enc);
+    cairo_t* cr = cairo_create(surface);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_paint(cr);
+    if (r->trails.enabled) {
+        draw_trails(&r->trails, r->bodies, r->nbodies, r->zoom, cr, r->width, r->height);
+    }
+    draw_bodies(r->bodies, r->nbodies, -1, r->zoom, cr, r->width, r->height);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    encoder_submit(&r->enc, surface, r->nrendered++);
+}
+
+struct body* add_body(struct renderer* r) {
+    r->bodies = realloc(r->bodies, (r->nbodies + 1) * sizeof(struct body));
+    struct body* body = &r->bodies[r->nbodies++];
+    memset(body, 0, sizeof(*body));
+    body->rad = 1.0;
+    return body;
+}
+
+void render_stream(struct renderer* r, FILE* in, double from, double to) {
+    char* line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, in) > 0) {
+        if (*line == 't' || *line == '\n') {
+            // column names
+        } else if (*line == '#') {
+            struct body* body = add_body(r);
+            char color[12];
+            double rad;
+            int a = sscanf(line, "# %15s %lf %10s %lf", body->name, &body->m, color, &rad);
+            if (a >= 3) {
+                set_color(body, color);
+            }
+            if (a >= 4) {
+                body->rad = rad;
+            }
+        } else {
+            char* p = line;
+            double t = strtod(p, &p);
+            if (t < from) {
+                continue;
+            }
+            if (t > to) {
+                break;
+            }
+            if (r->nframes++ % r->every) {
+                // not rendered, don't parse
+                continue;
+            }
+            for (int i = 0; i < r->nbodies; i++) {
+                for (int k = 0; k < 3; k++) {
+                    r->bodies[i].r[k] = strtod(p, &p);
+                }
+                for (int k = 0; k < 3; k++) {
+                    r->bodies[i].v[k] = strtod(p, &p);
+                }
+            }
+            render_frame(r);
+        }
+    }
+    free(line);
+}
+
+void render_traj(struct renderer* r, const char* fn, double from, double to) {
+    int fd = open(fn, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Cannot open file: '%s'\n", fn);
+        exit(1);
+    }
+    void* data = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    struct traj_reader reader;
+    if (data == MAP_FAILED || traj_open(&reader, data, st.st_size) < 0) {
+        fprintf(stderr, "Cannot parse file: '%s'\n", fn);
+        exit(1);
+    }
+
+    for (int i = 0; i < reader.nbodies; i++) {
+        struct body* body = add_body(r);
+        strcpy(body->name, reader.bodies[i].name);
+        body->m = reader.bodies[i].m;
+        if (reader.bodies[i].color[0]) {
+            set_color(body, reader.bodies[i].color);
+            body->rad = reader.bodies[i].rad;
+        }
+    }
+
+    double* rv = calloc(6 * reader.nbodies, sizeof(double));
+    for (long f = traj_find(&reader, from); f < reader.nframes; f++) {
+        if (traj_frame_time(&reader, f) < from) {
+            continue;
+        }
+        if (traj_frame_time(&reader, f) > to) {
+            break;
+        }
+        if (r->nframes++ % r->every) {
+            continue;
+        }
+        double t;
+        traj_read_frame(&reader, f, &t, rv);
+        for (int i = 0; i < reader.nbodies; i++) {
+            for (int k = 0; k < 3; k++) {
+                r->bodies[i].r[k] = rv[6*i+k];
+                r->bodies[i].v[k] = rv[6*i+3+k];
+            }
+        }
+        render_frame(r);
+    }
+    free(rv);
+    traj_close(&reader);
+    munmap(data, st.st_size ? st.st_size : 1);
+}
+
+void usage(const char* name) {
+    fprintf(stderr,
+            "%s [--traj file.nbt] [--out frames/frame] [--every 1] [--width 1024] [--height 768]\n"
+            "    [--zoom 0.1] [--format png|ppm] [--threads N] [--trails] [--from t] [--to t]\n"
+            "reads kernel output from stdin when --traj is not given\n", name);
+    exit(0);
+}
+
+int main(int argc, char** argv) {
+    const char* traj_fn = NULL;
+    const char* prefix = "frame";
+    double from = -INFINITY;
+    double to = INFINITY;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct renderer r = {
+        .width = 1024,
+        .height = 768,
+        .zoom = 0.1,
+        .every = 1
+    };
+    for (int i = 1; i < argc; i++) {
+        if (i < argc - 1 && !strcmp(argv[i], "--traj")) {
+            traj_fn = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--out")) {
+            prefix = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--every")) {
+            r.every = atol(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--width")) {
+            r.width = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--height")) {
+            r.height = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--zoom")) {
+            r.zoom = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--format")) {
+            r.enc.ppm = !strcmp(argv[++i], "ppm");
+        } else if (i < argc - 1 && !strcmp(argv[i], "--threads")) {
+            nthreads = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--from")) {
+            from = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--to")) {
+            to = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--trails")) {
+            r.trails.enabled = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (r.every < 1 || r.width < 1 || r.height < 1) {
+        usage(argv[0]);
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+
+    r.enc.prefix = prefix;
+    encoder_start(&r.enc, nthreads, r.width, r.height);
+    if (traj_fn) {
+        render_traj(&r, traj_fn, from, to);
+    } else {
+        render_stream(&r, stdin, from, to);
+    }
+    int ret = encoder_finish(&r.enc);
+    free_trails(&r.trails);
+    free(r.bodies);
+
+    fprintf(stderr, "%ld frames, %ld rendered\n", r.nframes, r.nrendered);
+    return ret < 0 ? 1 : 0;
+}
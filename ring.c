@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ring.h"
+
+static int make_addr(const char* addr, struct sockaddr_storage* sa, socklen_t* len, int passive) {
+    memset(sa, 0, sizeof(*sa));
+    if (!strncmp(addr, "unix:", 5)) {
+        struct sockaddr_un* un = (struct sockaddr_un*)sa;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, addr + 5, sizeof(un->sun_path) - 1);
+        *len = sizeof(*un);
+        return 0;
+    }
+
+    char host[256];
+    const char* colon = strrchr(addr, ':');
+    if (!colon || colon - addr >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = 0;
+
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] && strcmp(host, "*") ? host : NULL, colon + 1, &hints, &res)) {
+        return -1;
+    }
+    memcpy(sa, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void setup_fd(int fd, int family) {
+    if (family != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+int ring_connect(struct ring* ring, int rank, int size, const char* listen_addr, const char* next_addr) {
+    memset(ring, 0, sizeof(*ring));
+    ring->rank = rank;
+    ring->size = size;
+    ring->next_fd = ring->prev_fd = -1;
+
+    struct sockaddr_storage sa;
+    socklen_t len;
+    if (make_addr(listen_addr, &sa, &len, 1) < 0) {
+        fprintf(stderr, "Bad address: '%s'\n", listen_addr);
+        return -1;
+    }
+    int lfd = socket(sa.ss_family, SOCK_STREAM, 0);
+    if (lfd < 0) {
+        fprintf(stderr, "Cannot listen on '%s': %s\n", listen_addr, strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (sa.ss_family == AF_UNIX) {
+        unlink(((struct sockaddr_un*)&sa)->sun_path);
+    }
+    if (bind(lfd, (struct sockaddr*)&sa, len) < 0 || listen(lfd, 1) < 0) {
+        fprintf(stderr, "Cannot listen on '%s': %s\n", listen_addr, strerror(errno));
+        return -1;
+    }
+
+    // the next rank may not be listening yet
+    if (make_addr(next_addr, &sa, &len, 0) < 0) {
+        fprintf(stderr, "Bad address: '%s'\n", next_addr);
+        return -1;
+    }
+    for (int attempt = 0; ring->next_fd < 0; attempt++) {
+        int fd = socket(sa.ss_family, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr*)&sa, len) == 0) {
+            ring->next_fd = fd;
+        } else {
+            close(fd);
+            if (attempt == 3000) {
+                fprintf(stderr, "Cannot connect to '%s': %s\n", next_addr, strerror(errno));
+                return -1;
+            }
+            usleep(10000);
+        }
+    }
+    setup_fd(ring->next_fd, sa.ss_family);
+
+    ring->prev_fd = accept(lfd, NULL, NULL);
+    if (ring->prev_fd < 0) {
+        fprintf(stderr, "Cannot accept on '%s': %s\n", listen_addr, strerror(errno));
+        return -1;
+    }
+    setup_fd(ring->prev_fd, sa.ss_family);
+    close(lfd);
+    if (!strncmp(listen_addr, "unix:", 5)) {
+        unlink(listen_addr + 5);
+    }
+    return 0;
+}
+
+void ring_start(struct ring* ring, const void* send, size_t len, void* recv, size_t cap) {
+    ring->send_buf = send;
+    ring->send_len = len;
+    ring->send_hdr = len;
+    ring->sent = 0;
+    ring->recv_buf = recv;
+    ring->recv_cap = cap;
+    ring->received = 0;
+    ring->recv_hdr = 0;
+}
+
+static int io_failed(struct ring* ring, ssize_t ret, const char* what, int peer) {
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    // every rank runs the same steps, so a neighbour leaving midway has failed and so has the run
+    int rank = (peer + ring->size) % ring->size;
+    if (ret == 0 || errno == EPIPE || errno == ECONNRESET) {
+        fprintf(stderr, "Ring rank %d lost rank %d during %s\n", ring->rank, rank, what);
+    } else {
+        fprintf(stderr, "Ring rank %d: %s to rank %d failed: %s\n", ring->rank, what, rank, strerror(errno));
+    }
+    exit(1);
+}
+
+static int sending(struct ring* ring) {
+    return ring->sent < sizeof(uint64_t) + ring->send_len;
+}
+
+static int receiving(struct ring* ring) {
+    return ring->received < sizeof(uint64_t) || ring->received < sizeof(uint64_t) + ring->recv_hdr;
+}
+
+int ring_progress(struct ring* ring) {
+    size_t hdr = sizeof(uint64_t);
+    while (sending(ring)) {
+        const uint8_t* p = ring->sent < hdr
+            ? (const uint8_t*)&ring->send_hdr + ring->sent
+            : ring->send_buf + ring->sent - hdr;
+        size_t n = ring->sent < hdr ? hdr - ring->sent : hdr + ring->send_len - ring->sent;
+        ssize_t ret = send(ring->next_fd, p, n, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            io_failed(ring, ret, "send", ring->rank + 1);
+            break;
+        }
+        ring->sent += ret;
+    }
+    while (receiving(ring)) {
+        uint8_t* p = ring->received < hdr
+            ? (uint8_t*)&ring->recv_hdr + ring->received
+            : ring->recv_buf + ring->received - hdr;
+        size_t n = ring->received < hdr ? hdr - ring->received : hdr + ring->recv_hdr - ring->received;
+        ssize_t ret = recv(ring->prev_fd, p, n, 0);
+        if (ret <= 0) {
+            io_failed(ring, ret, "recv", ring->rank - 1);
+            break;
+        }
+        ring->received += ret;
+        if (ring->received == hdr && ring->recv_hdr > ring->recv_cap) {
+            fprintf(stderr, "Ring message too long: %llu\n", (unsigned long long)ring->recv_hdr);
+            exit(1);
+        }
+    }
+    return !sending(ring) && !receiving(ring);
+}
+
+size_t ring_finish(struct ring* ring) {
+    while (!ring_progress(ring)) {
+        struct pollfd fds[2] = {
+            {.fd = ring->next_fd, .events = sending(ring) ? POLLOUT : 0},
+            {.fd = ring->prev_fd, .events = receiving(ring) ? POLLIN : 0},
+        };
+        poll(fds, 2, -1);
+    }
+    return ring->recv_hdr;
+}
+
+void ring_close(struct ring* ring) {
+    if (ring->next_fd >= 0) { close(ring->next_fd); }
+    if (ring->prev_fd >= 0) { close(ring->prev_fd); }
+    ring->next_fd = ring->prev_fd = -1;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Ring of processes over stream sockets: every rank sends to the next
+  one and receives from the previous one. Addresses are "unix:/path"
+  or "host:port" (TCP).
+
+  An exchange is started with ring_start, advanced without blocking by
+  ring_progress (call it now and then while computing) and completed by
+  ring_finish. Messages are framed, a message longer than the receive
+  buffer is an error.
+ */
+
+struct ring {
+    int rank;
+    int size;
+    int next_fd;
+    int prev_fd;
+
+    // exchange in flight
+    const uint8_t* send_buf;
+    size_t send_len;
+    size_t sent;
+    uint64_t send_hdr;
+
+    uint8_t* recv_buf;
+    size_t recv_cap;
+    size_t received;
+    uint64_t recv_hdr;
+};
+
+int ring_connect(struct ring* ring, int rank, int size, const char* listen_addr, const char* next_addr);
+void ring_start(struct ring* ring, const void* send, size_t len, void* recv, size_t cap);
+int ring_progress(struct ring* ring);
+size_t ring_finish(struct ring* ring);
+void ring_close(struct ring* ring);
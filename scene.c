@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "scene.h"
+
+/*
+  Drawing shared by the GUI (solar.c) and the headless renderer (render.c),
+  it only needs cairo.
+ */
+
+void set_color(struct body* body, const char* color) {
+    int number = strtol(color, NULL, 16);
+    double r, g, b;
+    b = ((number >> 0) & 0xff) / 256.;
+    g = ((number >> 8) & 0xff) / 256.;
+    r = ((number >> 16) & 0xff) / 256.;
+
+    body->cr = r;
+    body->cg = g;
+    body->cb = b;
+}
+
+void draw_trails(struct trails* trails, struct body* bodies, int nbodies, double zoom, cairo_t* cr, int w, int h)
+{
+    if (!trails->surface
+        || cairo_image_surface_get_width(trails->surface) != w
+        || cairo_image_surface_get_height(trails->surface) != h)
+    {
+        if (trails->surface) {
+            cairo_surface_destroy(trails->surface);
+        }
+        trails->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+        trails->valid = 0;
+    }
+
+    cairo_t* tc = cairo_create(trails->surface);
+    if (!trails->valid) {
+        cairo_set_operator(tc, CAIRO_OPERATOR_CLEAR);
+        cairo_paint(tc);
+    } else if (++trails->frame % 4 == 0) {
+        // fade the whole history a bit
+        cairo_set_operator(tc, CAIRO_OPERATOR_DEST_OUT);
+        cairo_set_source_rgba(tc, 0, 0, 0, 0.1);
+        cairo_paint(tc);
+    }
+
+    // only the newest segment of every body is drawn
+    cairo_set_operator(tc, CAIRO_OPERATOR_OVER);
+    cairo_set_line_width(tc, 1);
+    for (int i = 0; i < nbodies; ++i)
+    {
+        struct body* body = &bodies[i];
+        double x = body->r[0] * w * zoom + w / 2.0;
+        double y = body->r[1] * w * zoom + h / 2.0;
+        if (trails->valid && !body->hidden[0] && !body->hidden[1]) {
+            cairo_set_source_rgb(tc, body->cr, body->cg, body->cb);
+            cairo_move_to(tc, body->trail_x, body->trail_y);
+            cairo_line_to(tc, x, y);
+            cairo_stroke(tc);
+        }
+        body->trail_x = x;
+        body->trail_y = y;
+    }
+    cairo_destroy(tc);
+    trails->valid = 1;
+
+    cairo_set_source_surface(cr, trails->surface, 0, 0);
+    cairo_paint(cr);
+}
+
+void draw_bodies(struct body* bodies, int nbodies, int active_body, double zoom, cairo_t* cr, int w, int h)
+{
+    for (int i = 0; i < nbodies; ++i)
+    {
+        struct body* body = &bodies[i];
+        double x = body->r[0] * w * zoom + w / 2.0;
+        double y = body->r[1] * w * zoom + h / 2.0;
+        if (active_body == i) {
+            cairo_set_source_rgb(cr, 1, 0, 0);
+        } else {
+            cairo_set_source_rgb(cr, body->cr, body->cg, body->cb);
+        }
+        cairo_arc(cr, x, y, 2*body->rad, 0, 2 * M_PI);
+        cairo_fill(cr);
+
+        body->x0 = x;
+        body->y0 = y;
+
+        if (body->show_tip)
+        {
+            cairo_set_font_size(cr, 13);
+            cairo_move_to(cr, x, y);
+            cairo_show_text(cr, body->name);
+        }
+    }
+}
+
+void free_trails(struct trails* trails)
+{
+    if (trails->surface) {
+        cairo_surface_destroy(trails->surface);
+        trails->surface = NULL;
+    }
+    trails->valid = 0;
+}
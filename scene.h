@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cairo.h>
+
+struct body
+{
+    double x0;
+    double y0;
+    int show_tip;
+
+    char name[16];
+    double r[3];
+    double v[3];
+    double m;
+    // bracketing frames, r and v are interpolated between them
+    double fr[2][3];
+    double fv[2][3];
+    // not in the frame (outside the view of the kernel): held still, no trail
+    int hidden[2];
+
+    // color
+    double cr;
+    double cg;
+    double cb;
+    // radius
+    double rad;
+    // last trail point, screen coordinates
+    double trail_x;
+    double trail_y;
+};
+
+// orbit trails: segments are accumulated in a fading image
+struct trails {
+    int enabled;
+    int valid;
+    int frame;
+    cairo_surface_t* surface;
+};
+
+void set_color(struct body* body, const char* color);
+
+void draw_trails(struct trails* trails, struct body* bodies, int nbodies, double zoom, cairo_t* cr, int w, int h);
+void draw_bodies(struct body* bodies, int nbodies, int active_body, double zoom, cairo_t* cr, int w, int h);
+void free_trails(struct trails* trails);
@@ -1,41 +1,44 @@
 #include <gtk/gtk.h>
 #include <gio/gio.h>
 
-struct body
-{
-    double x0;
-    double y0;
-    int show_tip;
-
-    char name[16];
-    double r[3];
-    double v[3];
-    double m;
-
-    // color
-    double cr;
-    double cg;
-    double cb;
-    // radius
-    double rad;
-};
+#include "traj.h"
+#include "scene.h"
 
 struct preset {
     const char* name;
     const char* input_file;
     int method;
     double dt;
+    double rate;
+    // --test-mass of the kernel, ring particles of Saturn attract nothing
+    double test_mass;
+};
+
+// counters of the performance overlay, summed over one second of wall-clock time
+struct perf {
+    int enabled;
+    gint64 start;
+    int draws;
+    gint64 draw_us;
+    gint64 draw_max_us;
+    int consumed;
+    int lines;
+    double t_read[2];
+    double t_display;
+    char text[6][80];
 };
 
 struct context {
     int nbodies;
-    struct body bodies[10000];
+    int bodies_cap;
+    struct body* bodies;
 
     GtkLabel* r[3];
     GtkLabel* v[3];
     int active_body;
 
     GtkWidget* body_selector;
+    struct _BodyList* body_list;
     GtkWidget* drawing_area;
 
     guint timer_id;
@@ -43,6 +46,8 @@ struct context {
     double zoom;
     double zoom_initial;
 
+    struct trails trails;
+
     GtkStringList* kernels;
 
     // kernel settings
@@ -52,50 +57,163 @@ struct context {
     int method;
     char input_file[100];
     double dt;
+    double test_mass;
+    // the kernel tunes its force pass on start, see autotune() in verlet.c
+    int autotune;
+
+    // simulated time per wall-clock second
+    double rate;
+    double t_display;
+    double t_frame[2];
+    int nframes;
+    gint64 last_tick;
 
     // controls
     GtkWidget* method_selector;
     GtkEntryBuffer* input_file_entry;
     GtkWidget* dt_selector;
+    GtkWidget* rate_selector;
 
     // child
     GSubprocess* subprocess;
 
     GInputStream* input;
+    GOutputStream* commands;
+    int paused;
     GCancellable* cancel_read;
     GDataInputStream* line_input;
     int header_processed;
-    int suspend;
+    // last view command, the kernel streams only what is on screen
+    char view[160];
+
+    // playback of a recorded trajectory
+    GMappedFile* playback_map;
+    struct traj_reader playback;
+    double* playback_buf;
+    long playback_frame;
+    int playing;
+    int timeline_lock;
+    GtkWidget* timeline;
+    GtkWidget* play_button;
+
+    struct perf perf;
+};
+
+/*
+  Names of the bodies for the body selector. Items are made on demand
+  from the body array, so only the visible rows of the popup cost anything.
+ */
+#define BODY_TYPE_LIST (body_list_get_type())
+G_DECLARE_FINAL_TYPE(BodyList, body_list, BODY, LIST, GObject)
+
+struct _BodyList {
+    GObject parent;
+    struct body* bodies;
+    guint n;
 };
 
+static GType body_list_get_item_type(GListModel* list) {
+    return GTK_TYPE_STRING_OBJECT;
+}
+
+static guint body_list_get_n_items(GListModel* list) {
+    return BODY_LIST(list)->n;
+}
+
+static gpointer body_list_get_item(GListModel* list, guint i) {
+    BodyList* self = BODY_LIST(list);
+    return i < self->n ? gtk_string_object_new(self->bodies[i].name) : NULL;
+}
+
+static void body_list_model_init(GListModelInterface* iface) {
+    iface->get_item_type = body_list_get_item_type;
+    iface->get_n_items = body_list_get_n_items;
+    iface->get_item = body_list_get_item;
+}
+
+G_DEFINE_TYPE_WITH_CODE(BodyList, body_list, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, body_list_model_init))
+
+static void body_list_class_init(BodyListClass* klass) { }
+
+static void body_list_init(BodyList* self) { }
+
+BodyList* body_list_new() {
+    return g_object_new(BODY_TYPE_LIST, NULL);
+}
+
+// the body array moves when it grows, so it is passed with every change of size
+void body_list_set_bodies(BodyList* self, struct body* bodies, guint n) {
+    guint removed = self->n;
+    self->bodies = bodies;
+    self->n = n;
+    if (removed || n) {
+        g_list_model_items_changed(G_LIST_MODEL(self), 0, removed, n);
+    }
+}
+
 void draw(GtkDrawingArea* da, cairo_t *cr, int w, int h, void* user_data)
 {
     struct context* ctx = user_data;
-    for (int i = 0; i < ctx->nbodies; ++i)
-    {
-        struct body* body = &ctx->bodies[i];
-        double x = body->r[0] * w * ctx->zoom + w / 2.0;
-        double y = body->r[1] * w * ctx->zoom + h / 2.0;
-        if (ctx->active_body == i) {
-            cairo_set_source_rgb(cr, 1, 0, 0);
-        } else {
-            cairo_set_source_rgb(cr, body->cr, body->cg, body->cb);
-        }
-        cairo_arc(cr, x, y, 2*body->rad, 0, 2 * M_PI);
+    gint64 start = g_get_monotonic_time();
+    if (ctx->trails.enabled) {
+        draw_trails(&ctx->trails, ctx->bodies, ctx->nbodies, ctx->zoom, cr, w, h);
+    }
+    draw_bodies(ctx->bodies, ctx->nbodies, ctx->active_body, ctx->zoom, cr, w, h);
+
+    struct perf* perf = &ctx->perf;
+    gint64 us = g_get_monotonic_time() - start;
+    perf->draws++;
+    perf->draw_us += us;
+    if (perf->draw_max_us < us) {
+        perf->draw_max_us = us;
+    }
+    if (perf->enabled) {
+        int n = sizeof(perf->text) / sizeof(perf->text[0]);
+        cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+        cairo_rectangle(cr, 4, 4, 300, 8 + 16 * n);
         cairo_fill(cr);
-
-        body->x0 = x;
-        body->y0 = y;
-
-        if (body->show_tip)
-        {
-            cairo_set_font_size(cr, 13);
-            cairo_move_to(cr, x, y);
-            cairo_show_text(cr, body->name);
+        cairo_set_source_rgb(cr, 1, 1, 1);
+        cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, 12);
+        for (int i = 0; i < n; i++) {
+            cairo_move_to(cr, 10, 20 + 16 * i);
+            cairo_show_text(cr, perf->text[i]);
         }
     }
 }
 
+// closes the current one-second window and formats the overlay lines
+void perf_update(struct context* ctx, gint64 now) {
+    struct perf* perf = &ctx->perf;
+    if (!perf->start) {
+        perf->start = now;
+        perf->t_display = ctx->t_display;
+        return;
+    }
+    double sec = (now - perf->start) * 1e-6;
+    if (sec < 1) {
+        return;
+    }
+    double steps = perf->lines > 1 && ctx->dt > 0 ? (perf->t_read[1] - perf->t_read[0]) / ctx->dt : 0;
+    gsize backlog = ctx->subprocess ? g_buffered_input_stream_get_available(G_BUFFERED_INPUT_STREAM(ctx->line_input)) : 0;
+    snprintf(perf->text[0], sizeof(perf->text[0]), "render      %6.1f fps", perf->draws / sec);
+    snprintf(perf->text[1], sizeof(perf->text[1]), "draw        %6.2f ms, max %.2f ms",
+             perf->draws ? perf->draw_us * 1e-3 / perf->draws : 0, perf->draw_max_us * 1e-3);
+    snprintf(perf->text[2], sizeof(perf->text[2]), "frames      %6.0f/s", perf->consumed / sec);
+    snprintf(perf->text[3], sizeof(perf->text[3]), "kernel      %.3e steps/s", steps / sec);
+    snprintf(perf->text[4], sizeof(perf->text[4]), "pipe        %zu bytes buffered", (size_t)backlog);
+    snprintf(perf->text[5], sizeof(perf->text[5]), "sim time    %.3e per s", (ctx->t_display - perf->t_display) / sec);
+
+    perf->start = now;
+    perf->draws = perf->consumed = perf->lines = 0;
+    perf->draw_us = perf->draw_max_us = 0;
+    perf->t_display = ctx->t_display;
+    if (perf->enabled) {
+        gtk_widget_queue_draw(ctx->drawing_area);
+    }
+}
+
 int get_body(double x, double y, struct context* ctx) {
     double mindist = -1;
     int argmin = -1;
@@ -151,6 +269,7 @@ void stop_kernel(struct context* ctx) {
 
         g_input_stream_close(G_INPUT_STREAM(ctx->line_input), NULL, NULL);
         g_input_stream_close(ctx->input, NULL, NULL);
+        g_output_stream_close(ctx->commands, NULL, NULL);
 
         g_object_unref(ctx->input);
         g_object_unref(ctx->line_input);
@@ -158,6 +277,37 @@ void stop_kernel(struct context* ctx) {
         // g_object_unref(ctx->subprocess);
 
         ctx->subprocess = NULL;
+        ctx->commands = NULL;
+    }
+}
+
+// the kernel applies commands between steps, see verlet.c
+void send_command(struct context* ctx, const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf) - 1, fmt, args);
+    va_end(args);
+    strcat(buf, "\n");
+    g_output_stream_write_all(ctx->commands, buf, strlen(buf), NULL, NULL, NULL);
+    g_output_stream_flush(ctx->commands, NULL, NULL);
+}
+
+void stop_playback(struct context* ctx);
+void playback_seek(struct context* ctx, double t);
+void clear_bodies(struct context* ctx);
+
+// display period; the kernel is asked for one frame per tick of simulated time, but not above one per step
+#define TICK_MS 16
+
+double frame_interval(struct context* ctx) {
+    return fmax(ctx->rate * TICK_MS * 1e-3, ctx->dt);
+}
+
+void send_pace(struct context* ctx) {
+    if (ctx->subprocess) {
+        send_command(ctx, "rate %.16e", ctx->rate);
+        send_command(ctx, "output %.16e", frame_interval(ctx));
     }
 }
 
@@ -170,6 +320,13 @@ void close_window(GtkWidget* widget, struct context* ctx)
     }
 
     stop_kernel(ctx);
+    stop_playback(ctx);
+    clear_bodies(ctx);
+    g_free(ctx->bodies);
+    ctx->bodies = NULL;
+    ctx->bodies_cap = 0;
+
+    free_trails(&ctx->trails);
 }
 
 void read_child(struct context* ctx);
@@ -190,6 +347,160 @@ void update_all(struct context* ctx) {
     gtk_widget_queue_draw(ctx->drawing_area);
 }
 
+void clear_bodies(struct context* ctx) {
+    body_list_set_bodies(ctx->body_list, ctx->bodies, 0);
+    ctx->nbodies = 0;
+    ctx->active_body = -1;
+    ctx->trails.valid = 0;
+}
+
+void reserve_bodies(struct context* ctx, int n) {
+    if (n > ctx->bodies_cap) {
+        ctx->bodies_cap = n > 2 * ctx->bodies_cap ? n : 2 * ctx->bodies_cap;
+        ctx->bodies = g_renew(struct body, ctx->bodies, ctx->bodies_cap);
+    }
+}
+
+void bodies_ready(struct context* ctx) {
+    body_list_set_bodies(ctx->body_list, ctx->bodies, ctx->nbodies);
+    ctx->active_body = 0;
+}
+
+double frame_time(const char* line) {
+    return atof(*line == 'v' ? line + 1 : line);
+}
+
+// "v t a [r v of a] i r i r ...", bodies without velocities move linearly between frames
+static void parse_view_bodies(struct context* ctx, char* p, const char* sep, int slot, int other, double h) {
+    int a = atoi(p);
+    if (a >= 0 && a < ctx->nbodies) {
+        struct body* body = &ctx->bodies[a];
+        for (int k = 0; k < 3; k++) {
+            if ((p = strtok(NULL, sep))) body->fr[slot][k] = atof(p);
+        }
+        for (int k = 0; k < 3; k++) {
+            if ((p = strtok(NULL, sep))) body->fv[slot][k] = atof(p);
+        }
+        body->hidden[slot] = 0;
+        if (body->hidden[other]) {
+            memcpy(body->fr[other], body->fr[slot], sizeof(body->fr[0]));
+            memcpy(body->fv[other], body->fv[slot], sizeof(body->fv[0]));
+        }
+    }
+    while ((p = strtok(NULL, sep))) {
+        int i = atoi(p);
+        double r[3] = {0};
+        for (int k = 0; k < 3; k++) {
+            if ((p = strtok(NULL, sep))) r[k] = atof(p);
+        }
+        if (i < 0 || i >= ctx->nbodies) {
+            continue;
+        }
+        struct body* body = &ctx->bodies[i];
+        body->hidden[slot] = 0;
+        for (int k = 0; k < 3; k++) {
+            body->fr[slot][k] = r[k];
+            if (body->hidden[other]) {
+                body->fr[other][k] = r[k];
+            }
+            body->fv[0][k] = body->fv[1][k] = h > 0 ? (body->fr[1][k] - body->fr[0][k]) / h : 0;
+        }
+    }
+}
+
+// a body that was outside the view in the other frame starts where it is, it does not fly in
+void parse_view(struct context* ctx, char* line, int slot) {
+    const char* sep = " ";
+    double h = ctx->t_frame[1] - ctx->t_frame[0];
+    int other = 1 - slot;
+    for (int i = 0; i < ctx->nbodies; i++) {
+        ctx->bodies[i].hidden[slot] = 1;
+    }
+    char* p = strtok(line, sep); // skip v
+    p = strtok(NULL, sep); // skip time
+    if (p && (p = strtok(NULL, sep))) {
+        parse_view_bodies(ctx, p, sep, slot, other, h);
+    }
+    // the rest keep their last position
+    for (int i = 0; i < ctx->nbodies; i++) {
+        struct body* body = &ctx->bodies[i];
+        if (body->hidden[slot]) {
+            memcpy(body->fr[slot], body->fr[other], sizeof(body->fr[0]));
+            memset(body->fv, 0, sizeof(body->fv));
+        }
+    }
+}
+
+void parse_frame(struct context* ctx, char* line, int slot) {
+    if (*line == 'v') {
+        parse_view(ctx, line, slot);
+        return;
+    }
+    const char* sep = " ";
+    char* p = line;
+    p = strtok(p, sep); // skip time
+    for (int i = 0; p && i < ctx->nbodies; i++) {
+        struct body* body = &ctx->bodies[i];
+        body->hidden[slot] = 0;
+        for (int k = 0; k < 3; k++) {
+            if ((p = strtok(NULL, sep))) body->fr[slot][k] = atof(p);
+        }
+        for (int k = 0; k < 3; k++) {
+            if ((p = strtok(NULL, sep))) body->fv[slot][k] = atof(p);
+        }
+    }
+}
+
+void shift_frame(struct context* ctx) {
+    ctx->t_frame[0] = ctx->t_frame[1];
+    for (int i = 0; i < ctx->nbodies; i++) {
+        struct body* body = &ctx->bodies[i];
+        memcpy(body->fr[0], body->fr[1], sizeof(body->fr[0]));
+        memcpy(body->fv[0], body->fv[1], sizeof(body->fv[0]));
+        body->hidden[0] = body->hidden[1];
+    }
+}
+
+void push_frame(struct context* ctx, char* line) {
+    shift_frame(ctx);
+    ctx->t_frame[1] = frame_time(line);
+    parse_frame(ctx, line, 1);
+    ctx->perf.consumed++;
+    if (ctx->nframes == 0) {
+        shift_frame(ctx);
+    }
+    if (ctx->nframes < 2) {
+        ctx->nframes++;
+    }
+}
+
+// cubic Hermite interpolation of positions with the frame velocities
+void interpolate(struct context* ctx) {
+    double h = ctx->t_frame[1] - ctx->t_frame[0];
+    double s = 1;
+    if (ctx->nframes > 1 && h > 0) {
+        s = (ctx->t_display - ctx->t_frame[0]) / h;
+        s = s < 0 ? 0 : (s > 1 ? 1 : s);
+    }
+    double h00 = (1 + 2 * s) * (1 - s) * (1 - s);
+    double h10 = s * (1 - s) * (1 - s);
+    double h01 = s * s * (3 - 2 * s);
+    double h11 = s * s * (s - 1);
+    for (int i = 0; i < ctx->nbodies; i++) {
+        struct body* body = &ctx->bodies[i];
+        for (int k = 0; k < 3; k++) {
+            body->r[k] = h00 * body->fr[0][k] + h10 * h * body->fv[0][k]
+                + h01 * body->fr[1][k] + h11 * h * body->fv[1][k];
+            body->v[k] = (1 - s) * body->fv[0][k] + s * body->fv[1][k];
+        }
+    }
+}
+
+void reset_frames(struct context* ctx) {
+    ctx->nframes = 0;
+    ctx->t_display = 0;
+}
+
 void on_new_data(GObject* input, GAsyncResult* res, gpointer user_data) {
     struct context* ctx = user_data;
 
@@ -198,64 +509,48 @@ void on_new_data(GObject* input, GAsyncResult* res, gpointer user_data) {
 
     if (line) {
         if (*line == 't') {
-            // skip column names
-        } else if (*line == '#' && ctx->nbodies < sizeof(ctx->bodies)/sizeof(struct body)) {
+            // column names, the kernel starts over after a reload
+            if (ctx->header_processed) {
+                clear_bodies(ctx);
+                ctx->header_processed = 0;
+                reset_frames(ctx);
+                ctx->trails.valid = 0;
+            }
+        } else if (*line == '#') {
             // header
+            reserve_bodies(ctx, ctx->nbodies + 1);
             struct body* body = &ctx->bodies[ctx->nbodies++];
+            memset(body, 0, sizeof(*body));
             body->cr = body->cg = body->cb = 0.0;
             body->rad = 1.0;
+            body->hidden[0] = body->hidden[1] = 1; // until the first frame
             char color[12];
             double rad;
             int a = sscanf(line, "# %15s %lf %10s %lf", body->name, &body->m, color, &rad);
             if (a >= 3) {
-                // parse color
-                int number = strtol(color, NULL, 16);
-                double r, g, b;
-                b = ((number >> 0) & 0xff) / 256.;
-                g = ((number >> 8) & 0xff) / 256.;
-                r = ((number >> 16) & 0xff) / 256.;
-
-                body->cr = r;
-                body->cg = g;
-                body->cb = b;
+                set_color(body, color);
             }
             if (a >= 4) {
                 body->rad = rad;
             }
         } else if (!ctx->header_processed) {
             ctx->header_processed = 1;
-
-            GtkStringList* strings = GTK_STRING_LIST(gtk_drop_down_get_model(GTK_DROP_DOWN(ctx->body_selector)));
-            for (int i = 0; i < ctx->nbodies; i++) {
-                gtk_string_list_append(strings, ctx->bodies[i].name);
-            }
-            ctx->active_body = 0;
+            bodies_ready(ctx);
         }
 
         if (ctx->header_processed) {
-            // parse line
-            const char* sep = " ";
-            char* p = line;
-            p = strtok(p, sep); // skip time
-            printf("time=%s\n", p);
-            for (int i = 0; p && i < ctx->nbodies; i++) {
-                if ((p = strtok(NULL, sep))) ctx->bodies[i].r[0] = atof(p);
-                if ((p = strtok(NULL, sep))) ctx->bodies[i].r[1] = atof(p);
-                if ((p = strtok(NULL, sep))) ctx->bodies[i].r[2] = atof(p);
-
-                if ((p = strtok(NULL, sep))) ctx->bodies[i].v[0] = atof(p);
-                if ((p = strtok(NULL, sep))) ctx->bodies[i].v[1] = atof(p);
-                if ((p = strtok(NULL, sep))) ctx->bodies[i].v[2] = atof(p);
+            // the kernel sends a frame per display tick and keeps to our rate, see send_pace()
+            double t = frame_time(line);
+            ctx->perf.t_read[ctx->perf.lines++ ? 1 : 0] = t;
+            if (ctx->nframes == 0) {
+                ctx->t_display = t;
             }
-
-            update_all(ctx);
-            ctx->suspend = 1;
+            push_frame(ctx, line);
         }
         g_free(line); // performance issue
 
-        if (!ctx->suspend) {
-            read_child(ctx);
-        }
+        // the pipe is always drained, commands never wait behind frames
+        read_child(ctx);
     }
 }
 
@@ -266,11 +561,45 @@ void read_child(struct context* ctx) {
         on_new_data, ctx);
 }
 
+// tells the kernel the visible box in the xy plane and the digits a pixel needs
+void update_view(struct context* ctx) {
+    int w = gtk_widget_get_width(ctx->drawing_area);
+    int h = gtk_widget_get_height(ctx->drawing_area);
+    if (!ctx->subprocess || w <= 0 || h <= 0) {
+        return;
+    }
+    double pixel = 1 / (w * ctx->zoom);
+    double margin = 20 * pixel;
+    double x = 0.5 * w * pixel + margin;
+    double y = 0.5 * h * pixel + margin;
+    int digits = ceil(log10(fmax(x, y) / pixel)) + 1;
+    digits = digits < 3 ? 3 : (digits > 9 ? 9 : digits);
+    char view[sizeof(ctx->view)];
+    snprintf(view, sizeof(view), "view %.6e %.6e %.6e %.6e %d %d", -x, -y, x, y, ctx->active_body, digits);
+    if (strcmp(view, ctx->view)) {
+        strcpy(ctx->view, view);
+        send_command(ctx, "%s", view);
+    }
+}
+
 gboolean timeout(struct context* ctx)
 {
-    if (ctx->header_processed && ctx->suspend) {
-        ctx->suspend = 0;
-        read_child(ctx);
+    gint64 now = g_get_monotonic_time();
+    double elapsed = ctx->last_tick ? (now - ctx->last_tick) * 1e-6 : 0;
+    ctx->last_tick = now;
+    perf_update(ctx, now);
+
+    if (ctx->playback_map) {
+        if (ctx->playing) {
+            playback_seek(ctx, ctx->t_display + ctx->rate * elapsed);
+        }
+    } else if (ctx->header_processed && ctx->nframes > 0) {
+        // the kernel behind: the newest frame is shown; ahead: the display jumps to the older bracket
+        ctx->t_display += ctx->rate * elapsed;
+        ctx->t_display = fmin(fmax(ctx->t_display, ctx->t_frame[0]), ctx->t_frame[1]);
+        interpolate(ctx);
+        update_all(ctx);
+        update_view(ctx);
     }
 
     return ctx->timer_id > 0;
@@ -282,33 +611,207 @@ void active_changed(GtkDropDown* self, GtkStateFlags flags, struct context* ctx)
     ctx->active_body = active;
 }
 
+static int name_contains(const char* name, const char* text, size_t len) {
+    for (; *name; name++) {
+        if (!g_ascii_strncasecmp(name, text, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// selects the next body whose name contains the text, starting from the given one
+void find_body(struct context* ctx, GtkEditable* entry, int from) {
+    const char* text = gtk_editable_get_text(entry);
+    size_t len = strlen(text);
+    if (!len || ctx->nbodies == 0) {
+        return;
+    }
+    for (int k = 0; k < ctx->nbodies; k++) {
+        int i = (from + k) % ctx->nbodies;
+        if (name_contains(ctx->bodies[i].name, text, len)) {
+            gtk_drop_down_set_selected(GTK_DROP_DOWN(ctx->body_selector), i);
+            ctx->active_body = i;
+            update_all(ctx);
+            return;
+        }
+    }
+}
+
+void search_changed(GtkSearchEntry* self, struct context* ctx)
+{
+    find_body(ctx, GTK_EDITABLE(self), ctx->active_body < 0 ? 0 : ctx->active_body);
+}
+
+void search_next(GtkSearchEntry* self, struct context* ctx)
+{
+    find_body(ctx, GTK_EDITABLE(self), ctx->active_body + 1);
+}
+
+// --method of verlet.exe for the entries of the method selector
+const char* kernel_methods[] = {"euler", "verlet", "ks"};
+
 void spawn(struct context* ctx) {
-    const gchar* exe = ctx->method == 0
-        ? "./euler.exe"
-        : "./verlet.exe";
-    gchar dt[40];
+    // no method chosen yet (-1): verlet, as the presets mostly use
+    int method = ctx->method >= 0 && ctx->method < (int)(sizeof(kernel_methods) / sizeof(kernel_methods[0])) ? ctx->method : 1;
+    gchar dt[40], rate[40], output[40], test_mass[40];
     snprintf(dt, sizeof(dt), "%.16e", ctx->dt);
+    snprintf(test_mass, sizeof(test_mass), "%.16e", ctx->test_mass);
+    snprintf(rate, sizeof(rate), "%.16e", ctx->rate);
+    snprintf(output, sizeof(output), "%.16e", frame_interval(ctx));
+    // calibration is kept per user, not in whatever directory the GUI was started from
+    gchar* calibration = g_build_filename(g_get_user_cache_dir(), "solar", "calibration.txt", NULL);
+    gchar* calibration_dir = g_path_get_dirname(calibration);
+    if (ctx->autotune) {
+        g_mkdir_with_parents(calibration_dir, 0700);
+    }
     const gchar* argv[] = {
-        exe,
+        "./verlet.exe",
+        "--method", kernel_methods[method],
         "--input", ctx->input_file,
         "--dt", dt,
+        "--test-mass", test_mass,
         "--T", "1e20",
+        "--control",
+        "--rate", rate,
+        "--output-dt", output,
+        ctx->autotune ? "--calibration" : NULL, calibration,
         NULL};
-    ctx->subprocess = g_subprocess_newv(argv, G_SUBPROCESS_FLAGS_STDOUT_PIPE, NULL);
+    ctx->subprocess = g_subprocess_newv(argv, G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDIN_PIPE, NULL);
     ctx->input = g_subprocess_get_stdout_pipe(ctx->subprocess);
+    ctx->commands = g_subprocess_get_stdin_pipe(ctx->subprocess);
     ctx->line_input = g_data_input_stream_new(ctx->input);
     ctx->cancel_read = g_cancellable_new();
+    ctx->view[0] = 0;
+    g_free(calibration_dir);
+    g_free(calibration);
 }
 
-void start_kernel(struct context* ctx) {
+void stop_playback(struct context* ctx) {
+    if (ctx->playback_map) {
+        traj_close(&ctx->playback);
+        g_mapped_file_unref(ctx->playback_map);
+        g_free(ctx->playback_buf);
+        ctx->playback_map = NULL;
+        ctx->playback_buf = NULL;
+        ctx->playing = 0;
+    }
+}
+
+void load_frame(struct context* ctx, long frame, int slot) {
+    traj_read_frame(&ctx->playback, frame, &ctx->t_frame[slot], ctx->playback_buf);
+    for (int i = 0; i < ctx->nbodies; i++) {
+        for (int k = 0; k < 3; k++) {
+            ctx->bodies[i].fr[slot][k] = ctx->playback_buf[6*i+k];
+            ctx->bodies[i].fv[slot][k] = ctx->playback_buf[6*i+3+k];
+        }
+        ctx->bodies[i].hidden[slot] = 0;
+    }
+}
+
+void playback_seek(struct context* ctx, double t) {
+    struct traj_reader* r = &ctx->playback;
+    double t_end = r->chunks[r->nchunks - 1].t_last;
+    if (t >= t_end) {
+        t = t_end;
+        ctx->playing = 0;
+    }
+
+    long frame = traj_find(r, t);
+    if (frame != ctx->playback_frame || ctx->nframes == 0) {
+        if (frame == ctx->playback_frame + 1 && ctx->nframes == 2) {
+            // the usual forward step: the decoder just goes on in the same chunk
+            shift_frame(ctx);
+        } else {
+            load_frame(ctx, frame, 0);
+        }
+        if (frame + 1 < r->nframes) {
+            load_frame(ctx, frame + 1, 1);
+            ctx->nframes = 2;
+        } else {
+            ctx->t_frame[1] = ctx->t_frame[0];
+            for (int i = 0; i < ctx->nbodies; i++) {
+                memcpy(ctx->bodies[i].fr[1], ctx->bodies[i].fr[0], sizeof(ctx->bodies[i].fr[0]));
+                memcpy(ctx->bodies[i].fv[1], ctx->bodies[i].fv[0], sizeof(ctx->bodies[i].fv[0]));
+            }
+            ctx->nframes = 1;
+        }
+        ctx->playback_frame = frame;
+    }
+    ctx->t_display = t;
+    interpolate(ctx);
+
+    ctx->timeline_lock = 1;
+    gtk_range_set_value(GTK_RANGE(ctx->timeline), t);
+    ctx->timeline_lock = 0;
+
+    update_all(ctx);
+}
+
+void start_playback(struct context* ctx, const char* fn) {
     stop_kernel(ctx);
+    stop_playback(ctx);
+    clear_bodies(ctx);
+
+    // the file is only mapped, frames are decoded from the mapping on demand
+    GError* error = NULL;
+    GMappedFile* map = g_mapped_file_new(fn, FALSE, &error);
+    if (!map) {
+        fprintf(stderr, "Cannot open file: '%s': %s\n", fn, error->message);
+        g_error_free(error);
+        return;
+    }
+    if (traj_open(&ctx->playback, g_mapped_file_get_contents(map), g_mapped_file_get_length(map)) < 0
+        || ctx->playback.nframes == 0)
+    {
+        fprintf(stderr, "Cannot parse file: '%s'\n", fn);
+        traj_close(&ctx->playback);
+        g_mapped_file_unref(map);
+        return;
+    }
+    ctx->playback_map = map;
+    ctx->playback_buf = g_new(double, 6 * ctx->playback.nbodies);
+    ctx->playback_frame = -1;
+    reset_frames(ctx);
+
+    int n = ctx->playback.nbodies;
+    reserve_bodies(ctx, n);
+    for (int i = 0; i < n; i++) {
+        struct body* body = &ctx->bodies[i];
+        memset(body, 0, sizeof(*body));
+        struct traj_body* src = &ctx->playback.bodies[i];
+        strcpy(body->name, src->name);
+        body->m = src->m;
+        body->cr = body->cg = body->cb = 0.0;
+        body->rad = src->color[0] ? src->rad : 1.0;
+        if (src->color[0]) {
+            set_color(body, src->color);
+        }
+    }
+    ctx->nbodies = n;
+    bodies_ready(ctx);
+
+    struct traj_reader* r = &ctx->playback;
+    double t0 = r->chunks[0].t_first;
+    double t1 = r->chunks[r->nchunks - 1].t_last;
+    ctx->timeline_lock = 1;
+    gtk_range_set_range(GTK_RANGE(ctx->timeline), t0, t1 > t0 ? t1 : t0 + 1);
+    ctx->timeline_lock = 0;
+    gtk_widget_set_sensitive(ctx->timeline, TRUE);
+    gtk_widget_set_sensitive(ctx->play_button, TRUE);
+    ctx->playing = 1;
+    playback_seek(ctx, t0);
+}
 
-    GtkStringList* strings = GTK_STRING_LIST(gtk_drop_down_get_model(GTK_DROP_DOWN(ctx->body_selector)));
-    gtk_string_list_splice(strings, 0, ctx->nbodies, NULL);
-    ctx->nbodies = 0;
-    ctx->active_body = -1;
+void start_kernel(struct context* ctx) {
+    stop_kernel(ctx);
+    stop_playback(ctx);
+    clear_bodies(ctx);
+    gtk_widget_set_sensitive(ctx->timeline, FALSE);
+    gtk_widget_set_sensitive(ctx->play_button, FALSE);
     ctx->header_processed = 0;
-    ctx->suspend = 0;
+    ctx->paused = 0;
+    reset_frames(ctx);
 
     spawn(ctx);
     read_child(ctx);
@@ -319,7 +822,11 @@ void method_changed(GtkDropDown* self, GtkStateFlags flags, struct context* ctx)
     int active = gtk_drop_down_get_selected(self);
     if (active != ctx->method) {
         ctx->method = active;
-        start_kernel(ctx);
+        if (ctx->subprocess) {
+            send_command(ctx, "method %s", kernel_methods[active]);
+        } else {
+            start_kernel(ctx);
+        }
     }
 }
 
@@ -331,11 +838,22 @@ void preset_changed(GtkDropDown* self, GtkStateFlags flags, struct context* ctx)
         struct preset* preset = &ctx->presets[active];
         ctx->method = preset->method;
         ctx->dt = preset->dt;
+        ctx->rate = preset->rate;
+        ctx->test_mass = preset->test_mass;
         strncpy(ctx->input_file, preset->input_file, sizeof(ctx->input_file));
         gtk_drop_down_set_selected(GTK_DROP_DOWN(ctx->method_selector), preset->method);
         gtk_spin_button_set_value(GTK_SPIN_BUTTON(ctx->dt_selector), preset->dt);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(ctx->rate_selector), preset->rate);
         gtk_entry_buffer_set_text(ctx->input_file_entry, preset->input_file, strlen(preset->input_file));
-        start_kernel(ctx);
+        if (ctx->subprocess) {
+            send_command(ctx, "dt %.16e", ctx->dt);
+            send_pace(ctx);
+            send_command(ctx, "method %s", kernel_methods[ctx->method]);
+            send_command(ctx, "test_mass %.16e", ctx->test_mass);
+            send_command(ctx, "reload %s", ctx->input_file);
+        } else {
+            start_kernel(ctx);
+        }
     }
 }
 
@@ -344,7 +862,11 @@ void input_file_changed(GtkEntry* self, struct context* ctx) {
     const char* text = gtk_entry_buffer_get_text(buffer);
     if (strcmp(text, ctx->input_file)) {
         strncpy(ctx->input_file, text, sizeof(ctx->input_file));
-        start_kernel(ctx);
+        if (ctx->subprocess) {
+            send_command(ctx, "reload %s", ctx->input_file);
+        } else {
+            start_kernel(ctx);
+        }
     }
 }
 
@@ -353,10 +875,85 @@ void dt_changed(GtkSpinButton* self, struct context* ctx)
     double value = gtk_spin_button_get_value(self);
     if (value != ctx->dt) {
         ctx->dt = value;
+        if (ctx->subprocess) {
+            send_command(ctx, "dt %.16e", ctx->dt);
+            send_pace(ctx);
+        } else {
+            start_kernel(ctx);
+        }
+    }
+}
+
+void playback_file_changed(GtkEntry* self, struct context* ctx) {
+    const char* text = gtk_entry_buffer_get_text(gtk_entry_get_buffer(self));
+    if (*text) {
+        start_playback(ctx, text);
+    } else {
         start_kernel(ctx);
     }
 }
 
+void timeline_changed(GtkRange* self, struct context* ctx)
+{
+    if (ctx->playback_map && !ctx->timeline_lock) {
+        ctx->trails.valid = 0;
+        playback_seek(ctx, gtk_range_get_value(self));
+    }
+}
+
+void play_clicked(GtkButton* self, struct context* ctx)
+{
+    if (ctx->playback_map) {
+        if (!ctx->playing && ctx->playback_frame + 1 >= ctx->playback.nframes) {
+            playback_seek(ctx, ctx->playback.chunks[0].t_first);
+        }
+        ctx->playing = !ctx->playing;
+    }
+}
+
+void pause_clicked(GtkButton* self, struct context* ctx)
+{
+    if (ctx->subprocess) {
+        ctx->paused = !ctx->paused;
+        send_command(ctx, ctx->paused ? "pause" : "resume");
+    }
+}
+
+// nudges the selected body by 1% of its velocity
+void kick_clicked(GtkButton* self, struct context* ctx)
+{
+    if (ctx->subprocess && ctx->active_body >= 0 && ctx->active_body < ctx->nbodies) {
+        double* v = ctx->bodies[ctx->active_body].v;
+        send_command(ctx, "perturb %d 0 0 0 %.16e %.16e %.16e",
+            ctx->active_body, 0.01 * v[0], 0.01 * v[1], 0.01 * v[2]);
+    }
+}
+
+void rate_changed(GtkSpinButton* self, struct context* ctx)
+{
+    ctx->rate = gtk_spin_button_get_value(self);
+    send_pace(ctx);
+}
+
+void trails_toggled(GtkCheckButton* self, struct context* ctx)
+{
+    ctx->trails.enabled = gtk_check_button_get_active(self);
+    ctx->trails.valid = 0;
+    gtk_widget_queue_draw(GTK_WIDGET(ctx->drawing_area));
+}
+
+// takes effect when the kernel is started next
+void autotune_toggled(GtkCheckButton* self, struct context* ctx)
+{
+    ctx->autotune = gtk_check_button_get_active(self);
+}
+
+void perf_toggled(GtkCheckButton* self, struct context* ctx)
+{
+    ctx->perf.enabled = gtk_check_button_get_active(self);
+    gtk_widget_queue_draw(GTK_WIDGET(ctx->drawing_area));
+}
+
 void zoom_begin(GtkGesture* gesture, GdkEventSequence* sequence, struct context* ctx)
 {
     ctx->zoom_initial = ctx->zoom;
@@ -365,6 +962,7 @@ void zoom_begin(GtkGesture* gesture, GdkEventSequence* sequence, struct context*
 void zoom_scale_changed(GtkGestureZoom* z, gdouble scale, struct context* ctx)
 {
     ctx->zoom = ctx->zoom_initial * scale;
+    ctx->trails.valid = 0;
     gtk_widget_queue_draw(GTK_WIDGET(ctx->drawing_area));
 }
 
@@ -375,6 +973,7 @@ void mouse_scroll(GtkEventControllerScroll* self, double dx, double dy, struct c
     } else if (dy < 0) {
         ctx->zoom *= 1.1;
     }
+    ctx->trails.valid = 0;
     gtk_widget_queue_draw(GTK_WIDGET(ctx->drawing_area));
 }
 
@@ -389,7 +988,7 @@ GtkWidget* control_widget(struct context* ctx) {
     g_signal_connect(preset_selector, "state-flags-changed", G_CALLBACK(preset_changed), ctx);
     gtk_box_append(GTK_BOX(box), preset_selector);
 
-    const char* methods[] = {"Euler", "Verlet", NULL};
+    const char* methods[] = {"Euler", "Verlet", "KS", NULL};
     gtk_box_append(GTK_BOX(box), gtk_label_new("Method:"));
     GtkWidget* method_selector = ctx->method_selector = gtk_drop_down_new_from_strings(methods);
     g_signal_connect(method_selector, "state-flags-changed", G_CALLBACK(method_changed), ctx);
@@ -409,6 +1008,58 @@ GtkWidget* control_widget(struct context* ctx) {
     g_signal_connect(dt, "value_changed", G_CALLBACK(dt_changed), ctx);
     gtk_box_append(GTK_BOX(box), dt);
 
+    gtk_box_append(GTK_BOX(box), gtk_label_new("Time per second:"));
+    GtkWidget* rate = ctx->rate_selector = gtk_spin_button_new_with_range(1e-8, 1e4, 0.0001);
+    gtk_spin_button_set_digits(GTK_SPIN_BUTTON(rate), 8);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(rate), ctx->rate);
+    g_signal_connect(rate, "value_changed", G_CALLBACK(rate_changed), ctx);
+    gtk_box_append(GTK_BOX(box), rate);
+
+    GtkWidget* trails = gtk_check_button_new_with_label("Trails");
+    g_signal_connect(trails, "toggled", G_CALLBACK(trails_toggled), ctx);
+    gtk_box_append(GTK_BOX(box), trails);
+
+    GtkWidget* perf = gtk_check_button_new_with_label("Performance overlay");
+    g_signal_connect(perf, "toggled", G_CALLBACK(perf_toggled), ctx);
+    gtk_box_append(GTK_BOX(box), perf);
+
+    GtkWidget* autotune = gtk_check_button_new_with_label("Autotune on start");
+    g_signal_connect(autotune, "toggled", G_CALLBACK(autotune_toggled), ctx);
+    gtk_box_append(GTK_BOX(box), autotune);
+
+    GtkWidget* pause = gtk_button_new_with_label("Pause/Resume");
+    g_signal_connect(pause, "clicked", G_CALLBACK(pause_clicked), ctx);
+    gtk_box_append(GTK_BOX(box), pause);
+
+    GtkWidget* kick = gtk_button_new_with_label("Kick selected body");
+    g_signal_connect(kick, "clicked", G_CALLBACK(kick_clicked), ctx);
+    gtk_box_append(GTK_BOX(box), kick);
+
+    return frame;
+}
+
+GtkWidget* playback_widget(struct context* ctx) {
+    GtkWidget* frame = gtk_frame_new("Playback");
+    GtkWidget* box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_frame_set_child(GTK_FRAME(frame), box);
+
+    gtk_box_append(GTK_BOX(box), gtk_label_new("Trajectory:"));
+    GtkWidget* entry = gtk_entry_new();
+    g_signal_connect(entry, "activate", G_CALLBACK(playback_file_changed), ctx);
+    gtk_box_append(GTK_BOX(box), entry);
+
+    GtkWidget* timeline = ctx->timeline = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 1, 1e-6);
+    gtk_scale_set_draw_value(GTK_SCALE(timeline), TRUE);
+    gtk_scale_set_digits(GTK_SCALE(timeline), 6);
+    gtk_widget_set_sensitive(timeline, FALSE);
+    g_signal_connect(timeline, "value_changed", G_CALLBACK(timeline_changed), ctx);
+    gtk_box_append(GTK_BOX(box), timeline);
+
+    GtkWidget* play = ctx->play_button = gtk_button_new_with_label("Play/Pause");
+    gtk_widget_set_sensitive(play, FALSE);
+    g_signal_connect(play, "clicked", G_CALLBACK(play_clicked), ctx);
+    gtk_box_append(GTK_BOX(box), play);
+
     return frame;
 }
 
@@ -417,13 +1068,21 @@ GtkWidget* info_widget(struct context* ctx) {
     GtkWidget* box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
     gtk_frame_set_child(GTK_FRAME(frame), box);
 
-    const char* strings[] = { NULL };
-    GtkWidget* body_selector = ctx->body_selector = gtk_drop_down_new_from_strings(strings);
+    ctx->body_list = body_list_new();
+    GtkExpression* name = gtk_property_expression_new(GTK_TYPE_STRING_OBJECT, NULL, "string");
+    GtkWidget* body_selector = ctx->body_selector = gtk_drop_down_new(G_LIST_MODEL(ctx->body_list), name);
 
     gtk_drop_down_set_selected(GTK_DROP_DOWN(body_selector), 0);
     g_signal_connect(body_selector, "state-flags-changed", G_CALLBACK(active_changed), ctx);
     gtk_box_append(GTK_BOX(box), body_selector);
 
+    GtkWidget* search = gtk_search_entry_new();
+    g_object_set(search, "placeholder-text", "Find body", NULL); // the setter needs GTK 4.10
+    g_signal_connect(search, "search-changed", G_CALLBACK(search_changed), ctx);
+    g_signal_connect(search, "activate", G_CALLBACK(search_next), ctx);
+    g_signal_connect(search, "next-match", G_CALLBACK(search_next), ctx);
+    gtk_box_append(GTK_BOX(box), search);
+
     for (int i = 0; i < 3; i++) {
         GtkWidget* x = gtk_label_new("-");
         gtk_box_append(GTK_BOX(box), x);
@@ -446,6 +1105,7 @@ GtkWidget* right_pane(struct context* ctx) {
     GtkWidget* box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 
     gtk_box_append(GTK_BOX(box), control_widget(ctx));
+    gtk_box_append(GTK_BOX(box), playback_widget(ctx));
     gtk_box_append(GTK_BOX(box), info_widget(ctx));
 
     gtk_widget_set_halign(box, GTK_ALIGN_END);
@@ -508,7 +1168,7 @@ void activate(GtkApplication* app, gpointer user_data)
     g_signal_connect(window, "destroy", G_CALLBACK(close_window), ctx);
 
     ctx->drawing_area = drawing_area;
-    ctx->timer_id = g_timeout_add(16, (GSourceFunc)timeout, ctx);
+    ctx->timer_id = g_timeout_add(TICK_MS, (GSourceFunc)timeout, ctx);
 
     gtk_window_present(GTK_WINDOW(window));
 }
@@ -516,10 +1176,10 @@ void activate(GtkApplication* app, gpointer user_data)
 int main(int argc, char **argv)
 {
     struct preset presets[] = {
-        {"2 Bodies", "2bodies.txt", 1, 0.00005},
-        {"3 Bodies", "3bodies.txt", 1, 0.00001},
-        {"Solar", "solar.txt", 1, 0.005},
-        {"Saturn", "saturn.txt", 1, 0.00001}
+        {"2 Bodies", "2bodies.txt", 1, 0.00005, 0.005, 0},
+        {"3 Bodies", "3bodies.txt", 2, 0.0001, 0.002, 0},
+        {"Solar", "solar.txt", 1, 0.005, 0.5, 0},
+        {"Saturn", "saturn.txt", 1, 0.00001, 0.0003, 0.01}
     };
 
     struct context ctx;
@@ -533,6 +1193,7 @@ int main(int argc, char **argv)
     ctx.method = -1;
     strncpy(ctx.input_file, "2bodies.txt", sizeof(ctx.input_file));
     ctx.dt = 1e-5;
+    ctx.rate = 0.005;
     ctx.presets = presets;
 
     gtk_disable_setlocale();
@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "traj.h"
+
+#define TRAJ_VERSION 1
+#define TRAJ_HEADER_SIZE 40
+#define TRAJ_BODY_SIZE 40
+#define TRAJ_CHUNK_HEADER_SIZE 32
+#define TRAJ_INDEX_ENTRY_SIZE 32
+#define TRAJ_TRAILER_SIZE 16
+#define TRAJ_CHUNK_MAGIC 0x4b43424eu // "NBCK"
+#define TRAJ_INDEX_MAGIC 0x5849424eu // "NBIX"
+#define TRAJ_ESCAPE 32
+
+static void put_u32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+static void put_u64(uint8_t* p, uint64_t v) { memcpy(p, &v, 8); }
+static void put_f64(uint8_t* p, double v) { memcpy(p, &v, 8); }
+static uint32_t get_u32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static uint64_t get_u64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static double get_f64(const uint8_t* p) { double v; memcpy(&v, p, 8); return v; }
+
+// quantized values are clamped to 2^59 so that 3 q1 - 3 q2 + q3 of the predictors fits in int64
+#define TRAJ_QMAX 576460752303423488.0
+
+static int64_t quant(double x, double q) {
+    double y = x / q;
+    if (!(y > -TRAJ_QMAX)) { return -(int64_t)TRAJ_QMAX; } // also NaN
+    if (y > TRAJ_QMAX) { return (int64_t)TRAJ_QMAX; }
+    return llround(y);
+}
+
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+static int rice_k(uint32_t mean) {
+    uint32_t m = mean >> 4;
+    return m ? 31 - __builtin_clz(m) : 0;
+}
+
+static void rice_update(uint32_t* mean, uint64_t zz) {
+    if (zz > (1u << 24)) { zz = 1u << 24; }
+    *mean += (uint32_t)zz - (*mean >> 4);
+}
+
+static void coder_init(struct traj_coder* c, int nbodies) {
+    c->prev = calloc(6 * nbodies, sizeof(int64_t));
+    c->prev2 = calloc(6 * nbodies, sizeof(int64_t));
+    c->prev3 = calloc(6 * nbodies, sizeof(int64_t));
+}
+
+static void coder_free(struct traj_coder* c) {
+    free(c->prev); free(c->prev2); free(c->prev3);
+}
+
+static void coder_reset(struct traj_coder* c) {
+    c->nframes = 0;
+    c->t_prev = 0;
+    for (int k = 0; k < 6; k++) {
+        c->mean[k] = 16 << 4;
+    }
+}
+
+static void coder_shift(struct traj_coder* c) {
+    int64_t* tmp = c->prev3;
+    c->prev3 = c->prev2;
+    c->prev2 = c->prev;
+    c->prev = tmp;
+}
+
+/*
+  Predictions and residuals wrap modulo 2^64 (unsigned arithmetic), the
+  writer and the reader agree on them whatever a damaged file decodes to.
+ */
+static int64_t wrap_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static int64_t wrap_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+
+// velocity prediction: extrapolation through the previous frames of the chunk
+static int64_t predict_v(const struct traj_coder* c, int i) {
+    uint64_t p1 = c->prev[i], p2 = c->prev2[i], p3 = c->prev3[i];
+    switch (c->nframes) {
+    case 0: return 0;
+    case 1: return (int64_t)p1;
+    case 2: return (int64_t)(2 * p1 - p2);
+    default: return (int64_t)(3 * p1 - 3 * p2 + p3);
+    }
+}
+
+// position prediction: trapezoid rule with the previous and the current velocity
+static int64_t predict_r(const struct traj_coder* c, int i, int64_t vq, double vscale) {
+    if (c->nframes == 0) { return 0; }
+    return wrap_add(c->prev[i], quant(0.5 * ((double)c->prev[i + 3] + (double)vq) * vscale, 1));
+}
+
+static void bits_reserve(struct traj_bits* b, size_t n) {
+    if (b->size + n > b->cap) {
+        b->cap = 2 * (b->size + n);
+        b->buf = realloc(b->buf, b->cap);
+    }
+}
+
+static void bits_put(struct traj_bits* b, uint32_t v, int n) {
+    b->acc |= (uint64_t)v << b->nbits;
+    b->nbits += n;
+    if (b->nbits >= 32) {
+        bits_reserve(b, 4);
+        put_u32(b->buf + b->size, (uint32_t)b->acc);
+        b->size += 4;
+        b->acc >>= 32;
+        b->nbits -= 32;
+    }
+}
+
+static void bits_flush(struct traj_bits* b) {
+    bits_reserve(b, 8);
+    while (b->nbits > 0) {
+        b->buf[b->size++] = (uint8_t)b->acc;
+        b->acc >>= 8;
+        b->nbits -= 8;
+    }
+    b->acc = 0;
+    b->nbits = 0;
+}
+
+static void rice_put(struct traj_bits* b, uint32_t* mean, int64_t v) {
+    uint64_t zz = zigzag(v);
+    int k = rice_k(*mean);
+    uint64_t q = zz >> k;
+    if (q < TRAJ_ESCAPE) {
+        // q ones, a zero, then k low bits
+        bits_put(b, (1u << q) - 1, q + 1);
+        if (k > 0) { bits_put(b, (uint32_t)(zz & ((1u << k) - 1)), k); }
+    } else {
+        bits_put(b, 0xffffffffu, TRAJ_ESCAPE);
+        bits_put(b, (uint32_t)zz, 32);
+        bits_put(b, (uint32_t)(zz >> 32), 32);
+    }
+    rice_update(mean, zz);
+}
+
+int traj_writer_open(struct traj_writer* w, const char* fn, int nbodies, const struct traj_body* bodies,
+                     double err_r, double err_v, int chunk_frames)
+{
+    memset(w, 0, sizeof(*w));
+    w->f = fopen(fn, "wb");
+    if (!w->f) { return -1; }
+    w->nbodies = nbodies;
+    w->qr = 2 * err_r;
+    w->qv = 2 * err_v;
+    w->chunk_frames = chunk_frames > 0 ? chunk_frames : TRAJ_CHUNK_FRAMES;
+    w->times = calloc(w->chunk_frames, sizeof(double));
+    coder_init(&w->coder, nbodies);
+    coder_reset(&w->coder);
+
+    uint8_t h[TRAJ_HEADER_SIZE] = "NBTRAJ1\n";
+    put_u32(h + 8, TRAJ_VERSION);
+    put_u32(h + 12, nbodies);
+    put_f64(h + 16, err_r);
+    put_f64(h + 24, err_v);
+    put_u32(h + 32, w->chunk_frames);
+    put_u32(h + 36, 0);
+    fwrite(h, 1, sizeof(h), w->f);
+    for (int i = 0; i < nbodies; i++) {
+        uint8_t b[TRAJ_BODY_SIZE] = {0};
+        strncpy((char*)b, bodies[i].name, 15);
+        put_f64(b + 16, bodies[i].m);
+        strncpy((char*)b + 24, bodies[i].color, 7);
+        put_f64(b + 32, bodies[i].rad);
+        fwrite(b, 1, sizeof(b), w->f);
+    }
+    w->offset = TRAJ_HEADER_SIZE + (uint64_t)nbodies * TRAJ_BODY_SIZE;
+    return 0;
+}
+
+static void flush_chunk(struct traj_writer* w) {
+    struct traj_coder* c = &w->coder;
+    if (c->nframes == 0) { return; }
+
+    bits_flush(&w->bits);
+    uint64_t payload = 8 * (uint64_t)c->nframes + w->bits.size;
+    uint8_t h[TRAJ_CHUNK_HEADER_SIZE];
+    put_u32(h, TRAJ_CHUNK_MAGIC);
+    put_u32(h + 4, c->nframes);
+    put_u64(h + 8, payload);
+    put_f64(h + 16, w->times[0]);
+    put_f64(h + 24, w->times[c->nframes - 1]);
+    fwrite(h, 1, sizeof(h), w->f);
+    fwrite(w->times, sizeof(double), c->nframes, w->f);
+    fwrite(w->bits.buf, 1, w->bits.size, w->f);
+    fflush(w->f);
+
+    if (w->nchunks == w->chunks_cap) {
+        w->chunks_cap = w->chunks_cap ? 2 * w->chunks_cap : 64;
+        w->chunks = realloc(w->chunks, w->chunks_cap * sizeof(struct traj_chunk));
+    }
+    struct traj_chunk* chunk = &w->chunks[w->nchunks++];
+    chunk->offset = w->offset;
+    chunk->t_first = w->times[0];
+    chunk->t_last = w->times[c->nframes - 1];
+    chunk->nframes = c->nframes;
+
+    w->offset += TRAJ_CHUNK_HEADER_SIZE + payload;
+    w->bits.size = 0;
+    coder_reset(c);
+}
+
+void traj_write_frame(struct traj_writer* w, double t, const double* rv) {
+    struct traj_coder* c = &w->coder;
+    struct traj_bits* b = &w->bits;
+    double vscale = (c->nframes > 0 ? t - c->t_prev : 0) * w->qv / w->qr;
+
+    bits_reserve(b, (size_t)w->nbodies * 6 * 13);
+    for (int i = 0; i < 6 * w->nbodies; i += 6) {
+        int64_t* cur = c->prev3; // overwritten by the shift below
+        for (int k = 0; k < 3; k++) {
+            int64_t vq = quant(rv[i + 3 + k], w->qv);
+            rice_put(b, &c->mean[3 + k], wrap_sub(vq, predict_v(c, i + 3 + k)));
+            cur[i + 3 + k] = vq;
+        }
+        for (int k = 0; k < 3; k++) {
+            int64_t rq = quant(rv[i + k], w->qr);
+            rice_put(b, &c->mean[k], wrap_sub(rq, predict_r(c, i + k, cur[i + 3 + k], vscale)));
+            cur[i + k] = rq;
+        }
+    }
+    coder_shift(c);
+
+    w->times[c->nframes++] = t;
+    c->t_prev = t;
+    if (c->nframes == w->chunk_frames) {
+        flush_chunk(w);
+    }
+}
+
+void traj_writer_close(struct traj_writer* w) {
+    if (!w->f) { return; }
+    flush_chunk(w);
+
+    uint64_t index_offset = w->offset;
+    for (int i = 0; i < w->nchunks; i++) {
+        uint8_t e[TRAJ_INDEX_ENTRY_SIZE];
+        put_u64(e, w->chunks[i].offset);
+        put_f64(e + 8, w->chunks[i].t_first);
+        put_f64(e + 16, w->chunks[i].t_last);
+        put_u32(e + 24, w->chunks[i].nframes);
+        put_u32(e + 28, 0);
+        fwrite(e, 1, sizeof(e), w->f);
+    }
+    uint8_t t[TRAJ_TRAILER_SIZE];
+    put_u64(t, index_offset);
+    put_u32(t + 8, w->nchunks);
+    put_u32(t + 12, TRAJ_INDEX_MAGIC);
+    fwrite(t, 1, sizeof(t), w->f);
+    fclose(w->f);
+    w->f = NULL;
+
+    coder_free(&w->coder);
+    free(w->times);
+    free(w->bits.buf);
+    free(w->chunks);
+}
+
+static void add_chunk(struct traj_reader* r, int* cap, uint64_t offset, double t_first, double t_last, uint32_t nframes) {
+    if (r->nchunks == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        r->chunks = realloc(r->chunks, *cap * sizeof(struct traj_chunk));
+    }
+    struct traj_chunk* c = &r->chunks[r->nchunks++];
+    c->offset = offset;
+    c->t_first = t_first;
+    c->t_last = t_last;
+    c->nframes = nframes;
+    c->first_frame = r->nframes;
+    r->nframes += nframes;
+}
+
+// a chunk header at offset that fits before end, with room for its frame times; returns the chunk size or 0
+static uint64_t check_chunk(const struct traj_reader* r, uint64_t offset, uint64_t end) {
+    if (offset > end || end - offset < TRAJ_CHUNK_HEADER_SIZE) { return 0; }
+    const uint8_t* h = r->data + offset;
+    uint64_t payload = get_u64(h + 8);
+    if (get_u32(h) != TRAJ_CHUNK_MAGIC || payload > end - offset - TRAJ_CHUNK_HEADER_SIZE
+        || payload < 8 * (uint64_t)get_u32(h + 4)) {
+        return 0;
+    }
+    return TRAJ_CHUNK_HEADER_SIZE + payload;
+}
+
+// the index is trusted only if its entries describe the chunks actually in the file, back to back
+static int read_index(struct traj_reader* r, uint64_t data_start) {
+    if (r->size < data_start + TRAJ_TRAILER_SIZE) { return -1; }
+    const uint8_t* t = r->data + r->size - TRAJ_TRAILER_SIZE;
+    if (get_u32(t + 12) != TRAJ_INDEX_MAGIC) { return -1; }
+    uint64_t offset = get_u64(t);
+    uint32_t n = get_u32(t + 8);
+    if (offset < data_start || offset > r->size - TRAJ_TRAILER_SIZE
+        || r->size - TRAJ_TRAILER_SIZE - offset != (uint64_t)n * TRAJ_INDEX_ENTRY_SIZE) {
+        return -1;
+    }
+    int cap = 0;
+    uint64_t next = data_start;
+    for (uint32_t i = 0; i < n; i++) {
+        const uint8_t* e = r->data + offset + (uint64_t)i * TRAJ_INDEX_ENTRY_SIZE;
+        uint64_t chunk = get_u64(e);
+        uint32_t nframes = get_u32(e + 24);
+        uint64_t len = check_chunk(r, chunk, offset);
+        if (chunk != next || len == 0 || get_u32(r->data + chunk + 4) != nframes) { return -1; }
+        add_chunk(r, &cap, chunk, get_f64(e + 8), get_f64(e + 16), nframes);
+        next = chunk + len;
+    }
+    return next == offset ? 0 : -1;
+}
+
+// no usable index (the writer was killed, or the index is damaged): walk the chunk headers, drop a truncated tail
+static void scan_chunks(struct traj_reader* r, uint64_t offset) {
+    int cap = 0;
+    uint64_t len;
+    while ((len = check_chunk(r, offset, r->size)) > 0) {
+        const uint8_t* h = r->data + offset;
+        add_chunk(r, &cap, offset, get_f64(h + 16), get_f64(h + 24), get_u32(h + 4));
+        offset += len;
+    }
+}
+
+int traj_open(struct traj_reader* r, const void* data, size_t size) {
+    memset(r, 0, sizeof(*r));
+    r->data = data;
+    r->size = size;
+    if (size < TRAJ_HEADER_SIZE || memcmp(data, "NBTRAJ1\n", 8) || get_u32(r->data + 8) != TRAJ_VERSION) {
+        return -1;
+    }
+    r->nbodies = get_u32(r->data + 12);
+    r->err_r = get_f64(r->data + 16);
+    r->err_v = get_f64(r->data + 24);
+    uint64_t data_start = TRAJ_HEADER_SIZE + (uint64_t)r->nbodies * TRAJ_BODY_SIZE;
+    if (size < data_start) { return -1; }
+
+    r->bodies = calloc(r->nbodies, sizeof(struct traj_body));
+    for (int i = 0; i < r->nbodies; i++) {
+        const uint8_t* b = r->data + TRAJ_HEADER_SIZE + (uint64_t)i * TRAJ_BODY_SIZE;
+        memcpy(r->bodies[i].name, b, 15);
+        r->bodies[i].m = get_f64(b + 16);
+        memcpy(r->bodies[i].color, b + 24, 7);
+        r->bodies[i].rad = get_f64(b + 32);
+    }
+
+    if (read_index(r, data_start) < 0) {
+        free(r->chunks);
+        r->chunks = NULL;
+        r->nchunks = 0;
+        r->nframes = 0;
+        scan_chunks(r, data_start);
+    }
+
+    coder_init(&r->coder, r->nbodies);
+    r->cur_chunk = -1;
+    r->cur_frame = -1;
+    return 0;
+}
+
+void traj_close(struct traj_reader* r) {
+    coder_free(&r->coder);
+    free(r->bodies);
+    free(r->chunks);
+    memset(r, 0, sizeof(*r));
+}
+
+static int find_chunk(struct traj_reader* r, long frame) {
+    int lo = 0, hi = r->nchunks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (r->chunks[mid].first_frame <= frame) { lo = mid; } else { hi = mid - 1; }
+    }
+    return lo;
+}
+
+static const double* chunk_times(struct traj_reader* r, int chunk) {
+    return (const double*)(r->data + r->chunks[chunk].offset + TRAJ_CHUNK_HEADER_SIZE);
+}
+
+double traj_frame_time(struct traj_reader* r, long frame) {
+    int c = find_chunk(r, frame);
+    const uint8_t* p = (const uint8_t*)(chunk_times(r, c) + (frame - r->chunks[c].first_frame));
+    return get_f64(p);
+}
+
+long traj_find(struct traj_reader* r, double t) {
+    if (r->nchunks == 0) { return 0; }
+    int lo = 0, hi = r->nchunks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (r->chunks[mid].t_first <= t) { lo = mid; } else { hi = mid - 1; }
+    }
+    const uint8_t* times = (const uint8_t*)chunk_times(r, lo);
+    long f = 0, n = r->chunks[lo].nframes;
+    while (f + 1 < n && get_f64(times + 8 * (f + 1)) <= t) {
+        f++;
+    }
+    return r->chunks[lo].first_frame + f;
+}
+
+static inline void refill(struct traj_reader* r) {
+    while (r->nbits <= 56) {
+        uint64_t byte = r->in < r->in_end ? *r->in++ : 0;
+        r->acc |= byte << r->nbits;
+        r->nbits += 8;
+    }
+}
+
+static inline uint64_t bits_get(struct traj_reader* r, int n) {
+    refill(r);
+    uint64_t v = r->acc & ((1ull << n) - 1);
+    r->acc >>= n;
+    r->nbits -= n;
+    return v;
+}
+
+static inline int64_t rice_get(struct traj_reader* r, uint32_t* mean) {
+    refill(r);
+    int k = rice_k(*mean);
+    // 64 ones (only in a damaged stream) are an escape as well
+    int q = ~r->acc ? __builtin_ctzll(~r->acc) : 64;
+    uint64_t zz;
+    if (q < TRAJ_ESCAPE) {
+        r->acc >>= q + 1;
+        r->nbits -= q + 1;
+        zz = ((uint64_t)q << k) | (k > 0 ? bits_get(r, k) : 0);
+    } else {
+        r->acc >>= TRAJ_ESCAPE;
+        r->nbits -= TRAJ_ESCAPE;
+        zz = bits_get(r, 32);
+        zz |= bits_get(r, 32) << 32;
+    }
+    rice_update(mean, zz);
+    return unzigzag(zz);
+}
+
+static void start_chunk(struct traj_reader* r, int chunk) {
+    const uint8_t* h = r->data + r->chunks[chunk].offset;
+    uint32_t n = get_u32(h + 4);
+    r->in = h + TRAJ_CHUNK_HEADER_SIZE + 8 * (uint64_t)n;
+    r->in_end = h + TRAJ_CHUNK_HEADER_SIZE + get_u64(h + 8);
+    r->acc = 0;
+    r->nbits = 0;
+    r->cur_chunk = chunk;
+    r->cur_frame = r->chunks[chunk].first_frame - 1;
+    coder_reset(&r->coder);
+}
+
+static void decode_frame(struct traj_reader* r, double t) {
+    struct traj_coder* c = &r->coder;
+    double qr = 2 * r->err_r, qv = 2 * r->err_v;
+    double vscale = (c->nframes > 0 ? t - c->t_prev : 0) * qv / qr;
+    int64_t* cur = c->prev3;
+    for (int i = 0; i < 6 * r->nbodies; i += 6) {
+        for (int k = 0; k < 3; k++) {
+            cur[i + 3 + k] = wrap_add(predict_v(c, i + 3 + k), rice_get(r, &c->mean[3 + k]));
+        }
+        for (int k = 0; k < 3; k++) {
+            cur[i + k] = wrap_add(predict_r(c, i + k, cur[i + 3 + k], vscale), rice_get(r, &c->mean[k]));
+        }
+    }
+    coder_shift(c);
+    c->nframes++;
+    c->t_prev = t;
+    r->cur_frame++;
+}
+
+int traj_read_frame(struct traj_reader* r, long frame, double* t, double* rv) {
+    if (frame < 0 || frame >= r->nframes) { return -1; }
+    int chunk = r->cur_chunk;
+    if (chunk < 0 || frame <= r->cur_frame || frame >= r->chunks[chunk].first_frame + r->chunks[chunk].nframes) {
+        // not a forward step inside the current chunk: restart at the chunk boundary
+        chunk = find_chunk(r, frame);
+        start_chunk(r, chunk);
+    }
+    const uint8_t* times = (const uint8_t*)chunk_times(r, chunk);
+    long first = r->chunks[chunk].first_frame;
+    while (r->cur_frame < frame) {
+        decode_frame(r, get_f64(times + 8 * (r->cur_frame + 1 - first)));
+    }
+
+    double qr = 2 * r->err_r, qv = 2 * r->err_v;
+    const int64_t* q = r->coder.prev;
+    for (int i = 0; i < 6 * r->nbodies; i += 6) {
+        for (int k = 0; k < 3; k++) {
+            rv[i + k] = q[i + k] * qr;
+            rv[i + 3 + k] = q[i + 3 + k] * qv;
+        }
+    }
+    *t = r->coder.t_prev;
+    return 0;
+}
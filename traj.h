@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  Compressed trajectory archive (.nbt).
+
+  header:
+    "NBTRAJ1\n" u32 version, u32 nbodies, f64 err_r, f64 err_v,
+    u32 chunk_frames, u32 reserved,
+    nbodies x { char name[16], f64 m, char color[8], f64 rad }
+  chunks:
+    u32 'NBCK', u32 nframes, u64 payload bytes, f64 t_first, f64 t_last,
+    f64 t[nframes], bit stream
+  index (written on close, optional for readers):
+    nchunks x { u64 offset, f64 t_first, f64 t_last, u32 nframes, u32 0 }
+    u64 index offset, u32 nchunks, u32 'NBIX'
+
+  Values are quantized to 2*err so that the absolute error is at most err.
+  Inside a chunk velocities are predicted by extrapolation of previous frames,
+  positions by the trapezoid rule from the previous position and velocities,
+  residuals are coded by an adaptive Rice coder. Every chunk starts from
+  scratch, so it can be decoded without the rest of the file.
+ */
+
+#define TRAJ_CHUNK_FRAMES 64
+
+struct traj_body {
+    char name[16];
+    double m;
+    char color[8];
+    double rad;
+};
+
+struct traj_bits {
+    uint8_t* buf;
+    size_t size;
+    size_t cap;
+    uint64_t acc;
+    int nbits;
+};
+
+struct traj_coder {
+    int64_t* prev;  // quantized frames f-1, f-2, f-3 (6 values per body)
+    int64_t* prev2;
+    int64_t* prev3;
+    double t_prev;
+    double dt_prev;
+    int nframes;    // frames decoded/encoded in the current chunk
+    uint32_t mean[6];
+};
+
+struct traj_chunk {
+    uint64_t offset;
+    double t_first;
+    double t_last;
+    uint32_t nframes;
+    long first_frame;
+};
+
+struct traj_writer {
+    FILE* f;
+    int nbodies;
+    double qr, qv;
+    int chunk_frames;
+    double* times;
+    struct traj_coder coder;
+    struct traj_bits bits;
+
+    struct traj_chunk* chunks;
+    int nchunks;
+    int chunks_cap;
+    uint64_t offset;
+};
+
+struct traj_reader {
+    const uint8_t* data;
+    size_t size;
+
+    int nbodies;
+    double err_r, err_v;
+    struct traj_body* bodies;
+
+    struct traj_chunk* chunks;
+    int nchunks;
+    long nframes;
+
+    // sequential decoder position
+    int cur_chunk;
+    long cur_frame;
+    const uint8_t* in;
+    const uint8_t* in_end;
+    uint64_t acc;
+    int nbits;
+    struct traj_coder coder;
+};
+
+int traj_writer_open(struct traj_writer* w, const char* fn, int nbodies, const struct traj_body* bodies,
+                     double err_r, double err_v, int chunk_frames);
+// rv: 6 values per body, r0 r1 r2 v0 v1 v2
+void traj_write_frame(struct traj_writer* w, double t, const double* rv);
+void traj_writer_close(struct traj_writer* w);
+
+// data must stay valid (e.g. mapped) while the reader is used
+int traj_open(struct traj_reader* r, const void* data, size_t size);
+void traj_close(struct traj_reader* r);
+// last frame with time <= t (0 if t is before the first frame)
+long traj_find(struct traj_reader* r, double t);
+double traj_frame_time(struct traj_reader* r, long frame);
+int traj_read_frame(struct traj_reader* r, long frame, double* t, double* rv);
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "traj.h"
+
+/*
+  Prints a trajectory archive in the text format of the kernels,
+  so the archive can be fed to anything that reads kernel output.
+ */
+
+void print_header(struct traj_reader* r) {
+    printf("t ");
+    for (int i = 0; i < r->nbodies; i++) {
+        for (int j = 0; j < 3; j++) {
+            printf("r%d,%d ", i, j);
+        }
+        for (int j = 0; j < 3; j++) {
+            printf("v%d,%d ", i, j);
+        }
+    }
+    printf("\n");
+    for (int i = 0; i < r->nbodies; i++) {
+        if (r->bodies[i].color[0]) {
+            printf("# %s %le %s %lf\n", r->bodies[i].name, r->bodies[i].m, r->bodies[i].color, r->bodies[i].rad);
+        } else {
+            printf("# %s %le\n", r->bodies[i].name, r->bodies[i].m);
+        }
+    }
+}
+
+void print(struct traj_reader* r, double t, const double* rv) {
+    printf("%e ", t);
+    for (int i = 0; i < 6 * r->nbodies; i += 6) {
+        printf("%e %e %e %e %e %e ", rv[i], rv[i+1], rv[i+2], rv[i+3], rv[i+4], rv[i+5]);
+    }
+    printf("\n");
+}
+
+void info(struct traj_reader* r, size_t size) {
+    printf("bodies: %d\n", r->nbodies);
+    printf("frames: %ld\n", r->nframes);
+    printf("chunks: %d\n", r->nchunks);
+    printf("error bound: r %e v %e\n", r->err_r, r->err_v);
+    if (r->nchunks > 0) {
+        printf("time: %e .. %e\n", r->chunks[0].t_first, r->chunks[r->nchunks-1].t_last);
+    }
+    printf("bytes: %zu (%.2f per value)\n", size, r->nframes ? (double)size / r->nframes / r->nbodies / 6 : 0);
+}
+
+const void* map_file(const char* fn, size_t* size) {
+    int fd = open(fn, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Cannot open file: '%s'\n", fn);
+        exit(1);
+    }
+    *size = st.st_size;
+    void* p = mmap(NULL, *size ? *size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Cannot map file: '%s'\n", fn);
+        exit(1);
+    }
+    return p;
+}
+
+// ring of bodies on circular orbits around a fixed center, integrated exactly
+double test_roundtrip(const char* fn, int nbodies, int nframes, double dt, double err, double* max_err) {
+    struct traj_body* bodies = calloc(nbodies, sizeof(struct traj_body));
+    double* rv = calloc(6 * nbodies, sizeof(double));
+    double* out = calloc(6 * nbodies, sizeof(double));
+    double M = 1e5;
+    for (int i = 0; i < nbodies; i++) {
+        snprintf(bodies[i].name, sizeof(bodies[i].name), "B%d", i);
+        bodies[i].m = 1.0 / nbodies;
+    }
+
+    struct traj_writer w;
+    if (traj_writer_open(&w, fn, nbodies, bodies, err, err, TRAJ_CHUNK_FRAMES) < 0) {
+        printf("Cannot create '%s'\n", fn);
+        exit(1);
+    }
+    for (int f = 0; f < nframes; f++) {
+        double t = f * dt;
+        for (int i = 0; i < nbodies; i++) {
+            double R = 1 + 0.2 * i / nbodies;
+            double w0 = sqrt(M / R / R / R);
+            double phi = w0 * t + 2 * M_PI * i / nbodies;
+            rv[6*i+0] = R * cos(phi); rv[6*i+1] = R * sin(phi); rv[6*i+2] = 0;
+            rv[6*i+3] = -R * w0 * sin(phi); rv[6*i+4] = R * w0 * cos(phi); rv[6*i+5] = 0;
+        }
+        traj_write_frame(&w, t, rv);
+    }
+    traj_writer_close(&w);
+
+    size_t size;
+    const void* data = map_file(fn, &size);
+    struct traj_reader r;
+    if (traj_open(&r, data, size) < 0 || r.nframes != nframes) {
+        printf("Cannot read back '%s'\n", fn);
+        exit(1);
+    }
+    *max_err = 0;
+    // random access first, then a sequential pass
+    for (int f = nframes - 1; f >= 0; f -= 97) {
+        double t;
+        traj_read_frame(&r, f, &t, out);
+        if (t != f * dt || traj_find(&r, t) != f) {
+            printf("Bad time at frame %d\n", f);
+            exit(1);
+        }
+    }
+    for (int f = 0; f < nframes; f++) {
+        double t;
+        traj_read_frame(&r, f, &t, out);
+        for (int i = 0; i < nbodies; i++) {
+            double R = 1 + 0.2 * i / nbodies;
+            double w0 = sqrt(M / R / R / R);
+            double phi = w0 * t + 2 * M_PI * i / nbodies;
+            double exact[6] = {R * cos(phi), R * sin(phi), 0, -R * w0 * sin(phi), R * w0 * cos(phi), 0};
+            for (int k = 0; k < 6; k++) {
+                double e = fabs(out[6*i+k] - exact[k]);
+                if (*max_err < e) {
+                    *max_err = e;
+                }
+            }
+        }
+    }
+    traj_close(&r);
+    munmap((void*)data, size);
+    remove(fn);
+    free(bodies); free(rv); free(out);
+
+    // ratio against the text output of the kernels
+    return (double)nframes * nbodies * 6 * 14 / size;
+}
+
+// values far outside the quantizer range (and NaN) come back clamped, frame after frame
+double test_extreme(const char* fn, double err) {
+    struct traj_body body = {.name = "X", .m = 1};
+    double rv[6], out[6];
+    double qmax = ldexp(1, 59) * 2 * err;
+    struct traj_writer w;
+    if (traj_writer_open(&w, fn, 1, &body, err, err, TRAJ_CHUNK_FRAMES) < 0) {
+        printf("Cannot create '%s'\n", fn);
+        exit(1);
+    }
+    int nframes = 100;
+    for (int f = 0; f < nframes; f++) {
+        double s = f % 2 ? -1 : 1;
+        for (int k = 0; k < 6; k++) {
+            rv[k] = k == 2 ? NAN : s * 1e300;
+        }
+        traj_write_frame(&w, f, rv);
+    }
+    traj_writer_close(&w);
+
+    size_t size;
+    const void* data = map_file(fn, &size);
+    struct traj_reader r;
+    double max_err = INFINITY;
+    if (traj_open(&r, data, size) == 0 && r.nframes == nframes) {
+        max_err = 0;
+        for (int f = 0; f < nframes; f++) {
+            double t, s = f % 2 ? -1 : 1;
+            traj_read_frame(&r, f, &t, out);
+            for (int k = 0; k < 6; k++) {
+                max_err = fmax(max_err, fabs(out[k] - (k == 2 ? -qmax : s * qmax)) / qmax);
+            }
+        }
+        traj_close(&r);
+    }
+    munmap((void*)data, size);
+    remove(fn);
+    return max_err;
+}
+
+// a damaged index is ignored: the chunks are found by walking their headers; returns the number of bad cases
+int test_damaged_index(const char* fn) {
+    struct traj_body body = {.name = "X", .m = 1};
+    double rv[6] = {0}, out[6];
+    struct traj_writer w;
+    if (traj_writer_open(&w, fn, 1, &body, 1e-6, 1e-6, 4) < 0) {
+        printf("Cannot create '%s'\n", fn);
+        exit(1);
+    }
+    int nframes = 18;
+    for (int f = 0; f < nframes; f++) {
+        rv[0] = f;
+        traj_write_frame(&w, f, rv);
+    }
+    traj_writer_close(&w);
+
+    size_t size;
+    const uint8_t* data = map_file(fn, &size);
+    uint8_t* copy = malloc(size);
+    uint64_t index, bad = ~0ull >> 1;
+    memcpy(&index, data + size - 16, 8);
+    // chunk offset past the end, frame count off by one, index offset past the end
+    struct { size_t at; const void* value; int len; } damage[] = {
+        {index + 32, &bad, 8}, {index + 2 * 32 + 24, &(uint32_t){5}, 4}, {size - 16, &bad, 8},
+    };
+    int failed = 0;
+    for (int d = 0; d < 3; d++) {
+        memcpy(copy, data, size);
+        memcpy(copy + damage[d].at, damage[d].value, damage[d].len);
+        struct traj_reader r;
+        int ok = traj_open(&r, copy, size) == 0 && r.nframes == nframes;
+        for (int f = 0; ok && f < nframes; f++) {
+            double t;
+            ok = traj_read_frame(&r, f, &t, out) == 0 && t == f && fabs(out[0] - f) < 1e-5;
+        }
+        traj_close(&r);
+        failed += !ok;
+    }
+    free(copy);
+    munmap((void*)data, size);
+    remove(fn);
+    return failed;
+}
+
+void run_test() {
+    char fn[] = "/tmp/trajcat_test_XXXXXX";
+    int fd = mkstemp(fn);
+    if (fd < 0) {
+        printf("Cannot create temporary file\n");
+        exit(1);
+    }
+    close(fd);
+
+    double err = 1e-6;
+    double max_err;
+    clock_t start = clock();
+    double ratio = test_roundtrip(fn, 200, 1000, 1e-5, err, &max_err);
+    double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%e %f %f\n", max_err, ratio, sec);
+    if (max_err > err * (1 + 1e-9)) {
+        printf("Error1\n");
+        exit(1);
+    }
+    if (ratio < 10) {
+        printf("Error2\n");
+        exit(2);
+    }
+
+    double extreme_err = test_extreme(fn, err);
+    printf("%e\n", extreme_err);
+    if (extreme_err > 1e-15) {
+        printf("Error3\n");
+        exit(3);
+    }
+
+    int damaged = test_damaged_index(fn);
+    printf("%d\n", damaged);
+    if (damaged) {
+        printf("Error4\n");
+        exit(4);
+    }
+    printf("Ok\n");
+    exit(0);
+}
+
+void usage(const char* name) {
+    fprintf(stderr, "%s file.nbt [--info] [--from t] [--to t] [--test]\n", name);
+    exit(0);
+}
+
+int main(int argc, char** argv) {
+    const char* fn = NULL;
+    double from = -INFINITY;
+    double to = INFINITY;
+    int info_mode = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i < argc - 1 && !strcmp(argv[i], "--from")) {
+            from = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--to")) {
+            to = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--info")) {
+            info_mode = 1;
+        } else if (!strcmp(argv[i], "--test")) {
+            run_test(); return 0;
+        } else if (argv[i][0] != '-' && !fn) {
+            fn = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!fn) {
+        usage(argv[0]);
+    }
+
+    size_t size;
+    const void* data = map_file(fn, &size);
+    struct traj_reader r;
+    if (traj_open(&r, data, size) < 0) {
+        fprintf(stderr, "Cannot parse file: '%s'\n", fn);
+        exit(1);
+    }
+    if (info_mode) {
+        info(&r, size);
+    } else {
+        double* rv = calloc(6 * r.nbodies, sizeof(double));
+        print_header(&r);
+        for (long f = traj_find(&r, from); f < r.nframes; f++) {
+            double t;
+            traj_read_frame(&r, f, &t, rv);
+            if (t > to) {
+                break;
+            }
+            if (t >= from) {
+                print(&r, t, rv);
+            }
+        }
+        free(rv);
+    }
+    traj_close(&r);
+    munmap((void*)data, size);
+    return 0;
+}
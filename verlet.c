@@ -2,6 +2,18 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "traj.h"
+#include "ring.h"
+#include "ic.h"
+#include "events.h"
+#include "dense.h"
 
 struct body {
     char name[16];
@@ -22,162 +34,1631 @@ struct data {
     struct body* bodies;
     double G;
     double dt;
+    // bodies not heavier than test_mass feel the others but attract nothing
+    double test_mass;
+    int* massive;
+    int nmassive;
+    // threads of the force pass and their buffers, see accel()
+    int threads;
+    struct pool* pool;
+    // bodies are kept along a Morton curve, see reorder()
+    int reorder;
+    int* order;
+    int* slot;
+
+    struct traj_writer* traj;
+    double* traj_buf;
+    struct events* events;  // rank 0 only
+    int observing;          // events requested, set on every rank of the ring
+
+    // frames every output_every-th step, or at multiples of output_dt
+    int output_every;
+    double output_dt;
+    long output_n;
+    long step;
+    double* dense;  // r, v, a of every body at the start of the step, then r, v at its end
+    int dense_n;
+
+    struct dist* dist;
+    struct parareal* parareal;
+
+    int method;
+    // KS regularization of close pairs
+    double ks_radius;
+    int ks_n;
+    int* ks_partner;
+    double* ks_r0;
+    struct ks_pair* ks_pairs;
+    int ks_npairs;
+
+    // command channel on stdin
+    int control;
+    int paused;
+    char cmd[4096];
+    int cmd_len;
+    // simulated time per wall-clock second a viewer wants, 0: no limit; see pace()
+    double rate;
+    double pace_t;
+    double pace_sec;
+    // subset of the frame a viewer asked for, see print_view()
+    int view;
+    double view_box[4];
+    int view_active;
+    int view_digits;
 };
 
-void verlet_init(struct data* data) {
+// body by its index in the input
+static inline struct body* body_at(struct data* data, int i) {
+    return data->slot ? &data->bodies[data->slot[i]] : &data->bodies[i];
+}
+
+#define METHOD_EULER 0
+#define METHOD_VERLET 1
+#define METHOD_KS 2
+
+// a regularized pair and its center of mass at the start of the step
+struct ks_pair {
+    int i, j;
+    double M;
+    double R0[3];
+    double V0[3];
+    double A0[3];
+};
+
+// RK4 steps per orbit of the KS oscillator
+#define KS_STEPS 256
+
+// parallel in time integration
+struct parareal {
+    int slices;     // also the number of threads
+    int steps;      // fine steps per slice
+    int ratio;      // fine steps per coarse step
+    double tol;
+
+    int windows;
+    int iterations;
+    double fine_sec;    // fine propagation time of one sweep, what a serial run would spend
+    double wall_sec;
+};
+
+// distributed mode: bodies [lo, hi) belong to this rank of the ring
+struct dist {
+    struct ring ring;
+    int lo;
+    int hi;
+    int block;
+    // blocks in transit: lo, count, then 5 (r, m, index) or 6 (r, v) values per body
+    double* cur;
+    double* nxt;
+};
+
+void dist_init(struct data* data, int rank, int size, const char* listen_addr, const char* next_addr) {
+    struct dist* d = calloc(1, sizeof(struct dist));
+    if (ring_connect(&d->ring, rank, size, listen_addr, next_addr) < 0) {
+        exit(1);
+    }
     int n = data->nbodies;
+    d->lo = (long)n * rank / size;
+    d->hi = (long)n * (rank + 1) / size;
+    d->block = (n + size - 1) / size;
+    d->cur = calloc(2 + 6 * d->block, sizeof(double));
+    d->nxt = calloc(2 + 6 * d->block, sizeof(double));
+    data->dist = d;
+}
+
+void dist_free(struct data* data) {
+    if (data->dist) {
+        ring_close(&data->dist->ring);
+        free(data->dist->cur);
+        free(data->dist->nxt);
+        free(data->dist);
+        data->dist = NULL;
+    }
+}
+
+// ranks 1..size-1 are forked and talk over unix sockets, the caller becomes rank 0
+#define RING_LOCAL_MAX 64
+
+void dist_local(struct data* data, int size) {
+    char addr[RING_LOCAL_MAX][108];
+    if (size > RING_LOCAL_MAX) {
+        fprintf(stderr, "--ring-local: at most %d ranks\n", RING_LOCAL_MAX);
+        exit(1);
+    }
+    for (int k = 0; k < size; k++) {
+        snprintf(addr[k], sizeof(addr[k]), "unix:/tmp/nbody-ring-%d-%d.sock", (int)getpid(), k);
+    }
+    int rank = 0;
+    for (int k = 1; k < size; k++) {
+        if (fork() == 0) {
+            rank = k;
+            break;
+        }
+    }
+    dist_init(data, rank, size, addr[rank], addr[(rank + 1) % size]);
+}
+
+/*
+  Systolic force pass: the block of positions of every rank travels around
+  the ring, each rank adds the contribution of the block in hand to its own
+  bodies while the block is being forwarded and the next one received.
+  Test particles stay at home, blocks carry the massive bodies only.
+ */
+void ring_accel(struct data* data) {
+    struct dist* d = data->dist;
     double G = data->G;
+    double* cur = d->cur;
+    double* nxt = d->nxt;
 
-    // new acc
-    for (int i = 0; i < n; i++) {
-        struct body* b1 = &data->bodies[i];
-        if (b1->fixed) continue;
+    int n = 0;
+    for (int i = d->lo; i < d->hi; i++) {
+        struct body* b = &data->bodies[i];
+        if (b->m > data->test_mass) {
+            double* p = cur + 2 + 5 * n++;
+            p[0] = b->r[0]; p[1] = b->r[1]; p[2] = b->r[2]; p[3] = b->m; p[4] = i;
+        }
+        if (!b->fixed) {
+            for (int k = 0; k < 3; k++) {
+                b->a_next[k] = 0;
+            }
+        }
+    }
+    cur[0] = d->lo;
+    cur[1] = n;
+
+    for (int s = 0; s < d->ring.size; s++) {
+        int last = s == d->ring.size - 1;
+        if (!last) {
+            ring_start(&d->ring, cur, (2 + 5 * (int)cur[1]) * sizeof(double), nxt, (2 + 6 * d->block) * sizeof(double));
+        }
+
+        int jn = cur[1];
+        for (int i = d->lo; i < d->hi; i++) {
+            if (!last && (i & 63) == 0) {
+                ring_progress(&d->ring);
+            }
+            struct body* b1 = &data->bodies[i];
+            if (b1->fixed) continue;
+
+            for (int j = 0; j < jn; j++) {
+                const double* b2 = cur + 2 + 5 * j;
+                if (i == (int)b2[4]) continue;
+
+                double R = 0;
+                for (int k = 0; k < 3; k++) {
+                    R += (b1->r[k] - b2[k]) * (b1->r[k] - b2[k]);
+                }
+                R = sqrt(R);
+
+                for (int k = 0; k < 3; k++) {
+                    b1->a_next[k] += G * b2[3] * (b2[k] - b1->r[k]) / R / R / R;
+                }
+            }
+        }
+
+        if (!last) {
+            ring_finish(&d->ring);
+            double* tmp = cur; cur = nxt; nxt = tmp;
+        }
+    }
+    d->cur = cur;
+    d->nxt = nxt;
+}
+
+// every rank gets r and v of all bodies (for output)
+void ring_gather(struct data* data) {
+    struct dist* d = data->dist;
+    double* cur = d->cur;
+    double* nxt = d->nxt;
+
+    cur[0] = d->lo;
+    cur[1] = d->hi - d->lo;
+    for (int i = d->lo; i < d->hi; i++) {
+        double* p = cur + 2 + 6 * (i - d->lo);
+        memcpy(p, data->bodies[i].r, 3 * sizeof(double));
+        memcpy(p + 3, data->bodies[i].v, 3 * sizeof(double));
+    }
+    for (int s = 0; s < d->ring.size - 1; s++) {
+        ring_start(&d->ring, cur, (2 + 6 * (int)cur[1]) * sizeof(double), nxt, (2 + 6 * d->block) * sizeof(double));
+        ring_finish(&d->ring);
+        int jlo = nxt[0];
+        for (int j = 0; j < (int)nxt[1]; j++) {
+            const double* p = nxt + 2 + 6 * j;
+            memcpy(data->bodies[jlo + j].r, p, 3 * sizeof(double));
+            memcpy(data->bodies[jlo + j].v, p + 3, 3 * sizeof(double));
+        }
+        double* tmp = cur; cur = nxt; nxt = tmp;
+    }
+    d->cur = cur;
+    d->nxt = nxt;
+}
+
+// indices of the bodies that attract, the force pass is O(N M) for M of them
+void find_massive(struct data* data) {
+    if (!data->massive) {
+        data->massive = malloc((data->nbodies + 1) * sizeof(int));
+    }
+    data->nmassive = 0;
+    for (int i = 0; i < data->nbodies; i++) {
+        if (data->bodies[i].m > data->test_mass) {
+            data->massive[data->nmassive++] = i;
+        }
+    }
+}
+
+/*
+  Bodies close in space are kept close in memory: the array is sorted by
+  the Morton key of the positions, 21 bits per coordinate of the bounding
+  box. order[k] is the input index of the body in place k, slot[i] is the
+  place of the input body i. Equal keys keep their current order.
+ */
+struct morton {
+    uint64_t key;
+    int k;
+};
+
+static uint64_t morton_spread(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+static int morton_cmp(const void* a, const void* b) {
+    const struct morton* x = a;
+    const struct morton* y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return x->k - y->k;
+}
 
+void reorder(struct data* data) {
+    int n = data->nbodies;
+    if (!data->order) {
+        data->order = malloc((n + 1) * sizeof(int));
+        data->slot = malloc((n + 1) * sizeof(int));
+        for (int i = 0; i < n; i++) {
+            data->order[i] = data->slot[i] = i;
+        }
+    }
+    double lo[3] = {INFINITY, INFINITY, INFINITY};
+    double hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = 0; i < n; i++) {
         for (int k = 0; k < 3; k++) {
-            b1->a[k] = 0;
+            lo[k] = fmin(lo[k], data->bodies[i].r[k]);
+            hi[k] = fmax(hi[k], data->bodies[i].r[k]);
         }
+    }
+    struct morton* keys = malloc((n + 1) * sizeof(struct morton));
+    for (int i = 0; i < n; i++) {
+        keys[i].key = 0;
+        keys[i].k = i;
+        for (int k = 0; k < 3; k++) {
+            double q = hi[k] > lo[k] ? (data->bodies[i].r[k] - lo[k]) / (hi[k] - lo[k]) : 0;
+            keys[i].key |= morton_spread((uint64_t)(q * 0x1fffff)) << k;
+        }
+    }
+    qsort(keys, n, sizeof(struct morton), morton_cmp);
 
-        for (int j = 0; j < n; j++) {
-            if (i == j) continue;
+    struct body* bodies = malloc((n + 1) * sizeof(struct body));
+    int* order = malloc((n + 1) * sizeof(int));
+    for (int p = 0; p < n; p++) {
+        bodies[p] = data->bodies[keys[p].k];
+        order[p] = data->order[keys[p].k];
+        data->slot[order[p]] = p;
+    }
+    free(data->bodies);
+    free(data->order);
+    free(keys);
+    data->bodies = bodies;
+    data->order = order;
+    find_massive(data);
+}
 
-            struct body* b2 = &data->bodies[j];
+/*
+  Direct force pass. Every pair of massive bodies is evaluated once and both
+  get their share, test particles only feel the massive bodies. The pairs
+  are cut into TILE x TILE tiles of the massive list, tile k goes to thread
+  k % nthreads, every thread sums into its own accumulator and these are
+  added in thread order, so the result does not depend on the schedule.
+ */
+#define TILE 256
 
-            double R = 0;
+struct pass {
+    struct data* data;
+    const double* p;    // x, y, z, m of the massive bodies
+    double* acc;        // 3 per massive body, the share of this thread
+    int id;
+    int nthreads;
+    struct pool* pool;
+};
+
+// workers live as long as the data, a pass wakes them up by bumping round
+struct pool {
+    int nthreads;       // workers and the calling thread
+    pthread_t* threads;
+    struct pass* w;
+    double* p;
+    double* acc;
+    int cap;            // massive bodies the buffers hold
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    long round;
+    int busy;
+    int quit;
+};
+
+static void pair_tile(const double* p, double* acc, int i0, int i1, int j0, int j1, double G) {
+    for (int i = i0; i < i1; i++) {
+        const double* pi = &p[4 * i];
+        double a[3] = {0, 0, 0};
+        for (int j = j0 > i ? j0 : i + 1; j < j1; j++) {
+            const double* pj = &p[4 * j];
+            double d[3] = {pj[0] - pi[0], pj[1] - pi[1], pj[2] - pi[2]};
+            double R2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            double f = G / (R2 * sqrt(R2));
             for (int k = 0; k < 3; k++) {
-                R += (b1->r[k] - b2->r[k]) * (b1->r[k] - b2->r[k]);
+                a[k] += f * pj[3] * d[k];
+                acc[3 * j + k] -= f * pi[3] * d[k];
             }
-            R = sqrt(R);
+        }
+        for (int k = 0; k < 3; k++) {
+            acc[3 * i + k] += a[k];
+        }
+    }
+}
 
+static void* pass_run(void* arg) {
+    struct pass* w = arg;
+    struct data* data = w->data;
+    int nm = data->nmassive;
+    int ntiles = (nm + TILE - 1) / TILE;
+    double G = data->G;
+
+    memset(w->acc, 0, 3 * nm * sizeof(double));
+    int k = 0;
+    for (int I = 0; I < ntiles; I++) {
+        for (int J = I; J < ntiles; J++, k++) {
+            if (k % w->nthreads == w->id) {
+                pair_tile(w->p, w->acc, I * TILE, I * TILE + TILE < nm ? I * TILE + TILE : nm,
+                          J * TILE, J * TILE + TILE < nm ? J * TILE + TILE : nm, G);
+            }
+        }
+    }
+
+    for (int i = w->id; i < data->nbodies; i += w->nthreads) {
+        struct body* b = &data->bodies[i];
+        if (b->fixed || b->m > data->test_mass) continue;
+
+        double a[3] = {0, 0, 0};
+        for (int j = 0; j < nm; j++) {
+            const double* pj = &w->p[4 * j];
+            double d[3] = {pj[0] - b->r[0], pj[1] - b->r[1], pj[2] - b->r[2]};
+            double R2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            double f = G * pj[3] / (R2 * sqrt(R2));
             for (int k = 0; k < 3; k++) {
-                b1->a[k] += G * b2->m * (b2->r[k] - b1->r[k]) / R / R / R;
+                a[k] += f * d[k];
+            }
+        }
+        memcpy(b->a_next, a, sizeof(a));
+    }
+    return NULL;
+}
+
+static void* pool_worker(void* arg) {
+    struct pass* w = arg;
+    struct pool* pool = w->pool;
+    long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->round == seen && !pool->quit) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+
+        pass_run(w);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static struct pool* pool_new(int nthreads) {
+    struct pool* pool = calloc(1, sizeof(struct pool));
+    pool->nthreads = nthreads > 1 ? nthreads : 1;
+    pool->threads = calloc(pool->nthreads, sizeof(pthread_t));
+    pool->w = calloc(pool->nthreads, sizeof(struct pass));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int t = 0; t < pool->nthreads; t++) {
+        pool->w[t].pool = pool;
+    }
+    for (int t = 1; t < pool->nthreads; t++) {
+        pthread_create(&pool->threads[t], NULL, pool_worker, &pool->w[t]);
+    }
+    return pool;
+}
+
+void pool_free(struct data* data) {
+    struct pool* pool = data->pool;
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 1; t < pool->nthreads; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads); free(pool->w); free(pool->p); free(pool->acc);
+    free(pool);
+    data->pool = NULL;
+}
+
+void accel(struct data* data) {
+    if (!data->massive) {
+        find_massive(data);
+    }
+    if (!data->pool) {
+        data->pool = pool_new(data->threads);
+    }
+    struct pool* pool = data->pool;
+    int nm = data->nmassive;
+    // workers are not worth waking for a few thousand pairs
+    int nthreads = (double)data->nbodies * nm > 1e5 ? pool->nthreads : 1;
+
+    if (pool->cap < nm || !pool->p) {
+        pool->cap = nm;
+        pool->p = realloc(pool->p, (4 * nm + 1) * sizeof(double));
+        pool->acc = realloc(pool->acc, (3 * nm * pool->nthreads + 1) * sizeof(double));
+    }
+    double* p = pool->p;
+    double* acc = pool->acc;
+    for (int a = 0; a < nm; a++) {
+        struct body* b = &data->bodies[data->massive[a]];
+        memcpy(&p[4 * a], b->r, sizeof(b->r));
+        p[4 * a + 3] = b->m;
+    }
+
+    // w[t].pool is the worker's own, it is not written while the worker waits
+    for (int t = 0; t < nthreads; t++) {
+        struct pass* w = &pool->w[t];
+        w->data = data;
+        w->p = p;
+        w->acc = &acc[3 * nm * t];
+        w->id = t;
+        w->nthreads = nthreads;
+    }
+    if (nthreads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->busy = nthreads - 1;
+        pool->round++;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pass_run(&pool->w[0]);
+    if (nthreads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->busy > 0) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    for (int a = 0; a < nm; a++) {
+        struct body* b = &data->bodies[data->massive[a]];
+        if (b->fixed) continue;
+        for (int k = 0; k < 3; k++) {
+            b->a_next[k] = 0;
+            for (int t = 0; t < nthreads; t++) {
+                b->a_next[k] += acc[3 * nm * t + 3 * a + k];
             }
         }
     }
 }
 
+void verlet_init(struct data* data) {
+    int lo = data->dist ? data->dist->lo : 0;
+    int hi = data->dist ? data->dist->hi : data->nbodies;
+
+    // new acc
+    if (data->dist) {
+        ring_accel(data);
+    } else {
+        find_massive(data);
+        accel(data);
+    }
+    for (int i = lo; i < hi; i++) {
+        memcpy(data->bodies[i].a, data->bodies[i].a_next, sizeof(data->bodies[i].a));
+    }
+}
+
+// position part of the Verlet step
+void drift(struct body* b, double dt) {
+    for (int k = 0; k < 3; k++) {
+        // new pos
+        b->r[k] = b->r[k] + b->v[k] * dt + b->a[k] * dt * dt * 0.5;
+    }
+
+    double R = 0;
+    if (b->min_rad >= 0 || b->max_rad >= 0) {
+        for (int k = 0; k < 3; k++) {
+            R += b->r[k] * b->r[k];
+        }
+        R = sqrt(R);
+    }
+
+    if (b->min_rad > 0 && R < b->min_rad) {
+        for (int k = 0; k < 3; k++) {
+            b->r[k] = b->min_rad * b->r[k] / R;
+        }
+    }
+    if (b->max_rad > 0 && R > b->max_rad) {
+        for (int k = 0; k < 3; k++) {
+            b->r[k] = b->max_rad * b->r[k] / R;
+        }
+    }
+}
+
 void verlet_next(struct data* data) {
-    int n = data->nbodies;
-    double G = data->G;
     double dt = data->dt;
+    int lo = data->dist ? data->dist->lo : 0;
+    int hi = data->dist ? data->dist->hi : data->nbodies;
 
-    for (int i = 0; i < n; i++) {
+    for (int i = lo; i < hi; i++) {
+        drift(&data->bodies[i], dt);
+    }
+
+    // new acc
+    if (data->dist) {
+        ring_accel(data);
+    } else {
+        accel(data);
+    }
+
+    for (int i = lo; i < hi; i++) {
+        struct body* b = &data->bodies[i];
+
+        for (int k = 0; k < 3; k++) {
+            // new vel
+            b->v[k] = b->v[k] + 0.5 * dt * (b->a[k] + b->a_next[k]);
+            // a = new acc
+            b->a[k] = b->a_next[k];
+        }
+    }
+}
+
+// explicit Euler with the same force pass, for switching on the fly
+void euler_next(struct data* data) {
+    double dt = data->dt;
+    int lo = data->dist ? data->dist->lo : 0;
+    int hi = data->dist ? data->dist->hi : data->nbodies;
+
+    if (data->dist) {
+        ring_accel(data);
+    } else {
+        accel(data);
+    }
+
+    for (int i = lo; i < hi; i++) {
         struct body* b = &data->bodies[i];
 
         for (int k = 0; k < 3; k++) {
-            // new pos
-            b->r[k] = b->r[k] + b->v[k] * dt + b->a[k] * dt * dt * 0.5;
+            b->a[k] = b->a_next[k];
+            b->v[k] = b->v[k] + dt * b->a[k];
+            b->r[k] = b->r[k] + dt * b->v[k];
         }
+    }
+}
 
-        double R = 0;
-        if (b->min_rad >= 0 || b->max_rad >= 0) {
+/*
+  Kustaanheimo-Stiefel regularization.
+
+  Mutually nearest bodies closer than ks_radius form a pair. The pair moves
+  as its center of mass in the Verlet step, the relative motion x = ri - rj
+  is integrated in KS variables u (x = L(u) u, |x| = u.u) with the
+  fictitious time s, dt = |x| ds:
+
+    u'' = h/2 u + |x|/2 L^T(u) P
+    h'  = 2 u' . L^T(u) P
+    t'  = |x|
+
+  where h = v^2/2 - G M/|x| and P is the tidal acceleration from the other
+  bodies. The equations have no singularity at x = 0, so close passes
+  need neither a small dt nor lose energy.
+ */
+
+static void ks_L(const double* u, const double* x, double* y) {
+    y[0] = u[0] * x[0] - u[1] * x[1] - u[2] * x[2] + u[3] * x[3];
+    y[1] = u[1] * x[0] + u[0] * x[1] - u[3] * x[2] - u[2] * x[3];
+    y[2] = u[2] * x[0] + u[3] * x[1] + u[0] * x[2] + u[1] * x[3];
+    y[3] = u[3] * x[0] - u[2] * x[1] + u[1] * x[2] - u[0] * x[3];
+}
+
+static void ks_LT(const double* u, const double* x, double* y) {
+    y[0] =  u[0] * x[0] + u[1] * x[1] + u[2] * x[2] + u[3] * x[3];
+    y[1] = -u[1] * x[0] + u[0] * x[1] + u[3] * x[2] - u[2] * x[3];
+    y[2] = -u[2] * x[0] - u[3] * x[1] + u[0] * x[2] + u[1] * x[3];
+    y[3] =  u[3] * x[0] - u[2] * x[1] + u[1] * x[2] - u[0] * x[3];
+}
+
+// y = {u[4], u'[4], h, t}
+static void ks_from(const double* x, const double* v, double mu, double* y) {
+    double r = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+    double* u = y;
+    if (x[0] >= 0) {
+        u[0] = sqrt(0.5 * (r + x[0]));
+        u[1] = 0.5 * x[1] / u[0];
+        u[2] = 0.5 * x[2] / u[0];
+        u[3] = 0;
+    } else {
+        u[1] = sqrt(0.5 * (r - x[0]));
+        u[0] = 0.5 * x[1] / u[1];
+        u[3] = 0.5 * x[2] / u[1];
+        u[2] = 0;
+    }
+    double v4[4] = {v[0], v[1], v[2], 0};
+    ks_LT(u, v4, y + 4);
+    for (int k = 0; k < 4; k++) {
+        y[4 + k] *= 0.5;
+    }
+    y[8] = 0.5 * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) - mu / r;
+    y[9] = 0;
+}
+
+static void ks_to(const double* y, double* x, double* v) {
+    double x4[4], v4[4];
+    double r = y[0] * y[0] + y[1] * y[1] + y[2] * y[2] + y[3] * y[3];
+    ks_L(y, y, x4);
+    ks_L(y, y + 4, v4);
+    for (int k = 0; k < 3; k++) {
+        x[k] = x4[k];
+        v[k] = 2 * v4[k] / r;
+    }
+}
+
+// tidal acceleration of the pair p with separation x at tau after the start of the step
+static void ks_perturbation(struct data* data, int p, double tau, const double* x, double* P) {
+    struct ks_pair* pair = &data->ks_pairs[p];
+    struct body* bi = &data->bodies[pair->i];
+    struct body* bj = &data->bodies[pair->j];
+    double G = data->G;
+    double ri[3], rj[3];
+    for (int k = 0; k < 3; k++) {
+        double R = pair->R0[k] + pair->V0[k] * tau + 0.5 * pair->A0[k] * tau * tau;
+        ri[k] = R + bj->m / pair->M * x[k];
+        rj[k] = R - bi->m / pair->M * x[k];
+        P[k] = 0;
+    }
+
+    for (int n = 0; n < data->nbodies + data->ks_npairs; n++) {
+        double m;
+        double p_k[3];
+        if (n < data->nbodies) {
+            // single massive bodies along their drift
+            struct body* b = &data->bodies[n];
+            if (data->ks_partner[n] >= 0 || b->m <= data->test_mass) continue;
+            const double* r0 = &data->ks_r0[3 * n];
+            m = b->m;
+            for (int k = 0; k < 3; k++) {
+                p_k[k] = r0[k] + b->v[k] * tau + 0.5 * b->a[k] * tau * tau;
+            }
+        } else {
+            // other pairs as their centers of mass
+            struct ks_pair* q = &data->ks_pairs[n - data->nbodies];
+            if (q == pair) continue;
+            m = q->M;
             for (int k = 0; k < 3; k++) {
-                R += b->r[k] * b->r[k];
+                p_k[k] = q->R0[k] + q->V0[k] * tau + 0.5 * q->A0[k] * tau * tau;
             }
-            R = sqrt(R);
         }
 
-        if (b->min_rad > 0 && R < b->min_rad) {
+        double Ri = 0, Rj = 0;
+        for (int k = 0; k < 3; k++) {
+            Ri += (p_k[k] - ri[k]) * (p_k[k] - ri[k]);
+            Rj += (p_k[k] - rj[k]) * (p_k[k] - rj[k]);
+        }
+        Ri = Ri * sqrt(Ri);
+        Rj = Rj * sqrt(Rj);
+        for (int k = 0; k < 3; k++) {
+            P[k] += G * m * ((p_k[k] - ri[k]) / Ri - (p_k[k] - rj[k]) / Rj);
+        }
+    }
+}
+
+static void ks_deriv(struct data* data, int p, double t0, const double* y, double* dy) {
+    double x4[4], LP[4];
+    double P[4] = {0};
+    double r = y[0] * y[0] + y[1] * y[1] + y[2] * y[2] + y[3] * y[3];
+    ks_L(y, y, x4);
+    ks_perturbation(data, p, t0 + y[9], x4, P);
+    ks_LT(y, P, LP);
+    double dh = 0;
+    for (int k = 0; k < 4; k++) {
+        dy[k] = y[4 + k];
+        dy[4 + k] = 0.5 * y[8] * y[k] + 0.5 * r * LP[k];
+        dh += y[4 + k] * LP[k];
+    }
+    dy[8] = 2 * dh;
+    dy[9] = r;
+}
+
+static void ks_rk4(struct data* data, int p, double t0, double* y, double ds) {
+    double k1[10], k2[10], k3[10], k4[10], tmp[10];
+    ks_deriv(data, p, t0, y, k1);
+    for (int k = 0; k < 10; k++) tmp[k] = y[k] + 0.5 * ds * k1[k];
+    ks_deriv(data, p, t0, tmp, k2);
+    for (int k = 0; k < 10; k++) tmp[k] = y[k] + 0.5 * ds * k2[k];
+    ks_deriv(data, p, t0, tmp, k3);
+    for (int k = 0; k < 10; k++) tmp[k] = y[k] + ds * k3[k];
+    ks_deriv(data, p, t0, tmp, k4);
+    for (int k = 0; k < 10; k++) {
+        y[k] += ds / 6 * (k1[k] + 2 * k2[k] + 2 * k3[k] + k4[k]);
+    }
+}
+
+// relative motion of the pair p over [0, dt]
+static void ks_advance(struct data* data, int p, double* x, double* v) {
+    struct ks_pair* pair = &data->ks_pairs[p];
+    double dt = data->dt;
+    double y[10];
+    ks_from(x, v, data->G * pair->M, y);
+
+    // steps in s until t(s) hits dt, the last ones converge like Newton's method
+    for (int step = 0; step < 10000000 && fabs(dt - y[9]) > 1e-14 * dt; step++) {
+        double r = y[0] * y[0] + y[1] * y[1] + y[2] * y[2] + y[3] * y[3];
+        double w = sqrt(fabs(y[8]) / 2);
+        double ds_max = 0.25 * dt / r;
+        if (w > 0 && ds_max > 2 * M_PI / w / KS_STEPS) {
+            ds_max = 2 * M_PI / w / KS_STEPS;
+        }
+        double ds = (dt - y[9]) / r;
+        if (ds > ds_max) {
+            ds = ds_max;
+        }
+        ks_rk4(data, p, 0, y, ds);
+    }
+    ks_to(y, x, v);
+}
+
+static int ks_candidate(struct data* data, struct body* b) {
+    return !b->fixed && b->min_rad <= 0 && b->max_rad <= 0 && b->m > data->test_mass;
+}
+
+// mutually nearest bodies closer than ks_radius that are bound or nearly so
+static void ks_find_pairs(struct data* data) {
+    int n = data->nbodies;
+    if (data->ks_n != n) {
+        data->ks_n = n;
+        data->ks_partner = realloc(data->ks_partner, n * sizeof(int));
+        data->ks_r0 = realloc(data->ks_r0, 3 * n * sizeof(double));
+        data->ks_pairs = realloc(data->ks_pairs, (n / 2 + 1) * sizeof(struct ks_pair));
+    }
+    double r2 = data->ks_radius * data->ks_radius;
+    for (int i = 0; i < n; i++) {
+        data->ks_partner[i] = -1;
+        if (!ks_candidate(data, &data->bodies[i])) continue;
+        double best = r2;
+        for (int j = 0; j < n; j++) {
+            if (i == j || !ks_candidate(data, &data->bodies[j])) continue;
+            double R = 0;
+            for (int k = 0; k < 3; k++) {
+                R += (data->bodies[i].r[k] - data->bodies[j].r[k]) * (data->bodies[i].r[k] - data->bodies[j].r[k]);
+            }
+            double v2 = 0;
             for (int k = 0; k < 3; k++) {
-                b->r[k] = b->min_rad * b->r[k] / R;
+                v2 += (data->bodies[i].v[k] - data->bodies[j].v[k]) * (data->bodies[i].v[k] - data->bodies[j].v[k]);
+            }
+            // bound or strongly focused: h < G M / R
+            if (R < best && 0.5 * v2 * sqrt(R) < 2 * data->G * (data->bodies[i].m + data->bodies[j].m)) {
+                best = R;
+                data->ks_partner[i] = j;
             }
         }
-        if (b->max_rad > 0 && R > b->max_rad) {
+    }
+
+    data->ks_npairs = 0;
+    for (int i = 0; i < n; i++) {
+        int j = data->ks_partner[i];
+        if (j >= 0 && data->ks_partner[j] != i) {
+            data->ks_partner[i] = -1;
+        } else if (j > i) {
+            struct body* bi = &data->bodies[i];
+            struct body* bj = &data->bodies[j];
+            struct ks_pair* pair = &data->ks_pairs[data->ks_npairs++];
+            pair->i = i;
+            pair->j = j;
+            pair->M = bi->m + bj->m;
             for (int k = 0; k < 3; k++) {
-                b->r[k] = b->max_rad * b->r[k] / R;
+                pair->R0[k] = (bi->m * bi->r[k] + bj->m * bj->r[k]) / pair->M;
+                pair->V0[k] = (bi->m * bi->v[k] + bj->m * bj->v[k]) / pair->M;
+                pair->A0[k] = (bi->m * bi->a[k] + bj->m * bj->a[k]) / pair->M;
             }
         }
     }
+}
 
-    // new acc
+// Verlet for single bodies and centers of mass, KS for the relative motion of pairs
+void ks_next(struct data* data) {
+    double dt = data->dt;
+    int n = data->nbodies;
+
+    ks_find_pairs(data);
     for (int i = 0; i < n; i++) {
-        struct body* b1 = &data->bodies[i];
-        if (b1->fixed) continue;
+        memcpy(&data->ks_r0[3 * i], data->bodies[i].r, sizeof(data->bodies[i].r));
+    }
+    for (int i = 0; i < n; i++) {
+        if (data->ks_partner[i] < 0) {
+            drift(&data->bodies[i], dt);
+        }
+    }
 
+    for (int p = 0; p < data->ks_npairs; p++) {
+        struct ks_pair* pair = &data->ks_pairs[p];
+        struct body* bi = &data->bodies[pair->i];
+        struct body* bj = &data->bodies[pair->j];
+        double x[3], v[3];
         for (int k = 0; k < 3; k++) {
-            b1->a_next[k] = 0;
+            x[k] = bi->r[k] - bj->r[k];
+            v[k] = bi->v[k] - bj->v[k];
         }
+        ks_advance(data, p, x, v);
+        for (int k = 0; k < 3; k++) {
+            double R = pair->R0[k] + pair->V0[k] * dt + 0.5 * pair->A0[k] * dt * dt;
+            bi->r[k] = R + bj->m / pair->M * x[k];
+            bj->r[k] = R - bi->m / pair->M * x[k];
+            // relative velocity until the center of mass gets its new one
+            bi->v[k] = v[k];
+        }
+    }
 
-        for (int j = 0; j < n; j++) {
-            if (i == j) continue;
+    accel(data);
 
-            struct body* b2 = &data->bodies[j];
+    for (int p = 0; p < data->ks_npairs; p++) {
+        struct ks_pair* pair = &data->ks_pairs[p];
+        struct body* bi = &data->bodies[pair->i];
+        struct body* bj = &data->bodies[pair->j];
+        for (int k = 0; k < 3; k++) {
+            double A1 = (bi->m * bi->a_next[k] + bj->m * bj->a_next[k]) / pair->M;
+            double V = pair->V0[k] + 0.5 * dt * (pair->A0[k] + A1);
+            double v = bi->v[k];
+            bi->v[k] = V + bj->m / pair->M * v;
+            bj->v[k] = V - bi->m / pair->M * v;
+            bi->a[k] = bi->a_next[k];
+            bj->a[k] = bj->a_next[k];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        struct body* b = &data->bodies[i];
+        if (data->ks_partner[i] >= 0) continue;
 
+        for (int k = 0; k < 3; k++) {
+            b->v[k] = b->v[k] + 0.5 * dt * (b->a[k] + b->a_next[k]);
+            b->a[k] = b->a_next[k];
+        }
+    }
+}
+
+double energy(struct data* data) {
+    double E = 0;
+    for (int i = 0; i < data->nbodies; i++) {
+        struct body* b1 = &data->bodies[i];
+        E += 0.5 * b1->m * (b1->v[0] * b1->v[0] + b1->v[1] * b1->v[1] + b1->v[2] * b1->v[2]);
+        for (int j = i + 1; j < data->nbodies; j++) {
+            struct body* b2 = &data->bodies[j];
+            // test particles do not attract each other, as in accel()
+            if (b1->m <= data->test_mass && b2->m <= data->test_mass) continue;
             double R = 0;
             for (int k = 0; k < 3; k++) {
                 R += (b1->r[k] - b2->r[k]) * (b1->r[k] - b2->r[k]);
             }
-            R = sqrt(R);
+            E -= data->G * b1->m * b2->m / sqrt(R);
+        }
+    }
+    return E;
+}
+
+/*
+  Parareal. The run is cut into windows of `slices` slices, U[n] is the
+  state (r, v of every body) at the start of slice n. The coarse Verlet
+  (dt * ratio) sweeps a window serially, the fine one (dt) runs all
+  slices at once in threads, and the correction
+
+    U[n+1] = G(U'[n]) + F(U[n]) - G(U[n])
+
+  is repeated until U stops changing. After k iterations the first k
+  slices are exact, so the fine runs start from slice k.
+ */
+
+static void pack(const struct body* bodies, int n, double* u) {
+    for (int i = 0; i < n; i++) {
+        memcpy(&u[6 * i], bodies[i].r, 3 * sizeof(double));
+        memcpy(&u[6 * i + 3], bodies[i].v, 3 * sizeof(double));
+    }
+}
+
+static void unpack(struct body* bodies, int n, const double* u) {
+    for (int i = 0; i < n; i++) {
+        memcpy(bodies[i].r, &u[6 * i], 3 * sizeof(double));
+        memcpy(bodies[i].v, &u[6 * i + 3], 3 * sizeof(double));
+    }
+}
+
+struct pr_job {
+    struct data data;   // private bodies
+    const double* in;
+    double* out;
+    int nsteps;
+    double sec;
+};
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* propagate(void* arg) {
+    struct pr_job* job = arg;
+    double start = now_sec();
+    unpack(job->data.bodies, job->data.nbodies, job->in);
+    verlet_init(&job->data);
+    for (int s = 0; s < job->nsteps; s++) {
+        verlet_next(&job->data);
+    }
+    pack(job->data.bodies, job->data.nbodies, job->out);
+    job->sec = now_sec() - start;
+    return NULL;
+}
+
+// U: slices + 1 states, U[0] is given, the rest is computed
+void parareal_window(struct data* data, double* U) {
+    struct parareal* p = data->parareal;
+    int P = p->slices;
+    int m = 6 * data->nbodies;
+    int coarse_steps = p->steps / p->ratio > 0 ? p->steps / p->ratio : 1;
+    double start = now_sec();
+
+    struct pr_job* jobs = calloc(P, sizeof(struct pr_job));
+    pthread_t* threads = calloc(P, sizeof(pthread_t));
+    double* F = calloc(P * m, sizeof(double));      // fine result of slice n
+    double* Gold = calloc(P * m, sizeof(double));   // coarse result of slice n
+    double* Gnew = calloc(m, sizeof(double));
+    for (int n = 0; n < P; n++) {
+        jobs[n].data = (struct data) {
+            .nbodies = data->nbodies,
+            .bodies = malloc(data->nbodies * sizeof(struct body)),
+            .G = data->G,
+            .dt = data->dt,
+            .test_mass = data->test_mass
+        };
+        memcpy(jobs[n].data.bodies, data->bodies, data->nbodies * sizeof(struct body));
+    }
+    struct pr_job coarse = jobs[0];
+    coarse.data.dt = data->dt * p->steps / coarse_steps;
+    coarse.nsteps = coarse_steps;
+
+    // initial coarse sweep
+    for (int n = 0; n < P; n++) {
+        coarse.in = &U[n * m];
+        coarse.out = &Gold[n * m];
+        propagate(&coarse);
+        memcpy(&U[(n + 1) * m], &Gold[n * m], m * sizeof(double));
+    }
+
+    double scale = 0;
+    for (int i = 0; i < (P + 1) * m; i++) {
+        scale = fmax(scale, fabs(U[i]));
+    }
+
+    for (int k = 0; k < P; k++) {
+        p->iterations++;
+        for (int n = k; n < P; n++) {
+            jobs[n].in = &U[n * m];
+            jobs[n].out = &F[n * m];
+            jobs[n].nsteps = p->steps;
+            pthread_create(&threads[n], NULL, propagate, &jobs[n]);
+        }
+        for (int n = k; n < P; n++) {
+            pthread_join(threads[n], NULL);
+            if (k == 0) {
+                p->fine_sec += jobs[n].sec;
+            }
+        }
+
+        // slice k is exact now, correct the rest serially
+        double change = 0;
+        memcpy(&U[(k + 1) * m], &F[k * m], m * sizeof(double));
+        for (int n = k + 1; n < P; n++) {
+            coarse.in = &U[n * m];
+            coarse.out = Gnew;
+            propagate(&coarse);
+            for (int i = 0; i < m; i++) {
+                double u = Gnew[i] + F[n * m + i] - Gold[n * m + i];
+                change = fmax(change, fabs(u - U[(n + 1) * m + i]));
+                U[(n + 1) * m + i] = u;
+            }
+            memcpy(&Gold[n * m], Gnew, m * sizeof(double));
+        }
+        if (change <= p->tol * scale) {
+            break;
+        }
+    }
+
+    for (int n = 0; n < P; n++) {
+        free(jobs[n].data.bodies);
+        free(jobs[n].data.massive);
+        pool_free(&jobs[n].data);
+    }
+    free(coarse.data.massive);
+    pool_free(&coarse.data);
+    free(jobs); free(threads); free(F); free(Gold); free(Gnew);
+    p->windows++;
+    p->wall_sec += now_sec() - start;
+}
+
+double kepler(double dt) {
+    double G = 1;
+    double MM = 1e5;
+
+    struct body bodies[] = {
+        {
+            .r = {0, 0, 0},
+            .v = {0, 0, 0},
+            .a = {0, 0, 0},
+            .m = MM,
+            .fixed = 1
+        },
+        {
+            .r = {0, 1, 0},
+            .v = {sqrt(G * MM), 0, 0},
+            .a = {0, 0, 0},
+            .m = 1,
+            .fixed = 0
+        },
+    };
+
+    struct data data = {
+        .nbodies = 2,
+        .bodies = &bodies[0],
+        .G = G,
+        .dt = dt
+    };
+
+    double max_err = 0;
+
+    verlet_init(&data);
+
+    double T = 0.1;
+    double t = 0;
+    while (t < T) {
+        verlet_next(&data);
+
+        double r = 0;
+        for (int k = 0; k < 3; k++) {
+            r += data.bodies[1].r[k] * data.bodies[1].r[k];
+        }
+        r = sqrt(r);
+        double err = fabs(r - 1.0);
+        if (max_err < err) {
+            max_err = err;
+        }
+	t += dt;
+    }
+    return max_err;
+}
+
+// random cluster around a fixed heavy body, the ring of 3 processes
+// against the single process kernel
+double ring_check(int nsteps) {
+    int n = 50;
+    struct body* bodies = calloc(n, sizeof(struct body));
+    struct body* copy = calloc(n, sizeof(struct body));
+    bodies[0].m = 100;
+    bodies[0].fixed = 1;
+    for (int i = 1; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            bodies[i].r[k] = sin(12.9898 * i + 78.233 * k) * 2;
+            bodies[i].v[k] = cos(4.1414 * i + 17.17 * k);
+        }
+        bodies[i].m = 1 + 0.1 * (i % 7);
+        bodies[i].min_rad = bodies[i].max_rad = -1;
+    }
+    bodies[0].min_rad = bodies[0].max_rad = -1;
+    memcpy(copy, bodies, n * sizeof(struct body));
+
+    struct data single = {.nbodies = n, .bodies = bodies, .G = 1, .dt = 1e-4};
+    verlet_init(&single);
+    for (int s = 0; s < nsteps; s++) {
+        verlet_next(&single);
+    }
+
+    struct data ring = {.nbodies = n, .bodies = copy, .G = 1, .dt = 1e-4};
+    dist_local(&ring, 3);
+    verlet_init(&ring);
+    for (int s = 0; s < nsteps; s++) {
+        verlet_next(&ring);
+    }
+    ring_gather(&ring);
+    if (ring.dist->ring.rank != 0) {
+        _exit(0);
+    }
+    dist_free(&ring);
+    while (wait(NULL) > 0) { }
+
+    double max_err = 0;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            double e = fabs(bodies[i].r[k] - copy[i].r[k]) + fabs(bodies[i].v[k] - copy[i].v[k]);
+            if (max_err < e) {
+                max_err = e;
+            }
+        }
+    }
+    free(bodies);
+    free(copy);
+    return max_err;
+}
+
+// relative energy error of a hierarchical triple: an eccentric binary
+// (a = 0.01, e = 0.9) with a third body at distance 1
+double ks_check(int method, double dt, double T) {
+    double a = 0.01, e = 0.9;
+    double rp = a * (1 - e);
+    double vp = sqrt(2 / rp * (1 + e) / 2);
+    struct body bodies[] = {
+        {.r = {0.5 * rp, 0, 0}, .v = {0, 0.5 * vp, 0}, .m = 1},
+        {.r = {-0.5 * rp, 0, 0}, .v = {0, -0.5 * vp, 0}, .m = 1},
+        {.r = {0, 1, 0}, .v = {-sqrt(2.0), 0, 0}, .m = 1},
+    };
+    for (int i = 0; i < 3; i++) {
+        bodies[i].min_rad = bodies[i].max_rad = -1;
+    }
+    struct data data = {.nbodies = 3, .bodies = bodies, .G = 1, .dt = dt, .ks_radius = 0.1};
+    double E0 = energy(&data);
+    double max_err = 0;
+    verlet_init(&data);
+    for (double t = 0; t < T; t += dt) {
+        if (method == METHOD_KS) {
+            ks_next(&data);
+        } else {
+            verlet_next(&data);
+        }
+        double err = fabs(energy(&data) / E0 - 1);
+        if (max_err < err) {
+            max_err = err;
+        }
+    }
+    free(data.ks_partner);
+    free(data.ks_r0);
+    free(data.ks_pairs);
+    return max_err;
+}
+
+// parareal against the serial Verlet on a planetary system
+double parareal_check(struct parareal* p) {
+    int n = 6;
+    double M = 1e5;
+    struct body* bodies = calloc(n, sizeof(struct body));
+    bodies[0].m = M;
+    bodies[0].min_rad = bodies[0].max_rad = -1;
+    for (int i = 1; i < n; i++) {
+        double R = 1 + 0.4 * i;
+        double phi = 2.4 * i;
+        bodies[i].r[0] = R * cos(phi);
+        bodies[i].r[1] = R * sin(phi);
+        bodies[i].v[0] = -sqrt(M / R) * sin(phi);
+        bodies[i].v[1] = sqrt(M / R) * cos(phi);
+        bodies[i].m = 1;
+        bodies[i].min_rad = bodies[i].max_rad = -1;
+    }
+
+    struct data data = {.nbodies = n, .bodies = bodies, .G = 1, .dt = 1e-5, .parareal = p};
+    int m = 6 * n;
+    double* U = calloc((p->slices + 1) * m, sizeof(double));
+    pack(bodies, n, U);
+    parareal_window(&data, U);
+
+    verlet_init(&data);
+    for (int s = 0; s < p->slices * p->steps; s++) {
+        verlet_next(&data);
+    }
+    double* ref = calloc(m, sizeof(double));
+    pack(bodies, n, ref);
+    double max_err = 0;
+    for (int i = 0; i < m; i++) {
+        max_err = fmax(max_err, fabs(ref[i] - U[p->slices * m + i]));
+    }
+    free(U); free(ref); free(bodies);
+    return max_err;
+}
+
+// periapsides of an orbit with e = 0.5 around a fixed center
+double events_check(double* period_err) {
+    double M = 1e5, a = 1, e = 0.5;
+    double T = 2 * M_PI * sqrt(a * a * a / M);
+    struct body bodies[] = {
+        {.m = M, .fixed = 1, .min_rad = -1, .max_rad = -1},
+        {.r = {a * (1 - e), 0, 0}, .v = {0, sqrt(M / a * (1 + e) / (1 - e)), 0}, .m = 1, .min_rad = -1, .max_rad = -1},
+    };
+    struct data data = {.nbodies = 2, .bodies = bodies, .G = 1, .dt = 2e-6};
+    double m[2] = {M, 1};
+    double rv[12];
+    struct events ev;
+    events_init(&ev, tmpfile(), 2, m);
+
+    verlet_init(&data);
+    for (double t = 0; t < 3.5 * T; t += data.dt) {
+        pack(bodies, 2, rv);
+        events_step(&ev, t, rv);
+        verlet_next(&data);
+    }
+    rewind(ev.out);
+    char kind[16];
+    double t, d, v, period;
+    int i, j, nperi = 0;
+    double max_err = 0;
+    *period_err = 0;
+    while (fscanf(ev.out, "%15s %lf %d %d %lf %lf %lf", kind, &t, &i, &j, &d, &v, &period) == 7) {
+        int peri = !strcmp(kind, "peri");
+        nperi += peri;
+        max_err = fmax(max_err, fabs(d - a * (peri ? 1 - e : 1 + e)));
+        if (peri && period > 0) {
+            *period_err = fmax(*period_err, fabs(period / T - 1));
+        }
+    }
+    fclose(ev.out);
+    events_free(&ev);
+    // periapsides at T, 2T, 3T and apoapsides at T/2, 3T/2, 5T/2, 7T/2
+    return nperi == 3 ? max_err : INFINITY;
+}
+
+void solve(struct data* data, double T);
+
+// events of a few eccentric orbits in one process and in a ring, as "kind i j t" lines
+static int ring_events(int ring_size, char* out, int size) {
+    int n = 7;
+    struct body bodies[7] = {{.m = 1e5, .fixed = 1, .min_rad = -1, .max_rad = -1}};
+    for (int i = 1; i < n; i++) {
+        double a = 1 + 0.3 * i, e = 0.1 * i;
+        double phi = 2.1 * i;
+        double v = sqrt(1e5 / a * (1 - e) / (1 + e));
+        bodies[i] = (struct body) {
+            .r = {a * (1 + e) * cos(phi), a * (1 + e) * sin(phi), 0},
+            .v = {-v * sin(phi), v * cos(phi), 0},
+            .m = 1, .min_rad = -1, .max_rad = -1
+        };
+    }
+    struct data data = {.nbodies = n, .bodies = bodies, .G = 1, .dt = 1e-5, .observing = 1, .output_every = 0};
+    if (ring_size > 1) {
+        dist_local(&data, ring_size);
+    }
+    int rank0 = !data.dist || data.dist->ring.rank == 0;
+    if (rank0) {
+        double m[7];
+        for (int i = 0; i < n; i++) {
+            m[i] = bodies[i].m;
+        }
+        data.events = calloc(1, sizeof(struct events));
+        events_init(data.events, tmpfile(), n, m);
+        data.traj_buf = calloc(6 * n, sizeof(double));
+    }
+    solve(&data, 5000 * data.dt);
+    if (!rank0) {
+        _exit(0);
+    }
+    dist_free(&data);
+    while (wait(NULL) > 0) { }
+
+    FILE* f = data.events->out;
+    rewind(f);
+    char kind[16];
+    double te;
+    int i, j, len = 0, count = 0;
+    char line[256];
+    out[0] = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%15s %lf %d %d", kind, &te, &i, &j) == 4) {
+            len += snprintf(out + len, size - len, "%s %d %d %.6e\n", kind, i, j, te);
+            count++;
+        }
+    }
+    fclose(f);
+    events_free(data.events);
+    free(data.events);
+    free(data.traj_buf);
+    free(data.massive);
+    pool_free(&data);
+    return count;
+}
+
+void open_traj(struct data* data, const char* fn, double err_r, double err_v);
+void close_traj(struct data* data);
+
+// frames of a disk around a fixed star written by solve() with Morton reordering every K steps
+static char* reorder_frames(int K, size_t* size) {
+    int n = 64;
+    struct body* bodies = calloc(n, sizeof(struct body));
+    bodies[0] = (struct body) {.m = 1e5, .fixed = 1, .min_rad = -1, .max_rad = -1};
+    for (int i = 1; i < n; i++) {
+        double R = 1 + 0.05 * i;
+        double phi = 2.4 * i;
+        bodies[i] = (struct body) {
+            .r = {R * cos(phi), R * sin(phi), 0.01 * (i % 5)},
+            .v = {-sqrt(1e5 / R) * sin(phi), sqrt(1e5 / R) * cos(phi), 0},
+            .m = 1 + i % 3, .min_rad = -1, .max_rad = -1
+        };
+    }
+    char fn[] = "/tmp/verlet-reorder-XXXXXX";
+    close(mkstemp(fn));
+    struct data data = {.nbodies = n, .bodies = bodies, .G = 1, .dt = 1e-5, .reorder = K, .threads = 1, .output_every = 10};
+    open_traj(&data, fn, 1e-12, 1e-12);
+    solve(&data, 200 * data.dt);
+    close_traj(&data);
+
+    FILE* f = fopen(fn, "rb");
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    char* buf = malloc(*size);
+    *size = fread(buf, 1, *size, f);
+    fclose(f);
+    unlink(fn);
+    free(data.massive);
+    pool_free(&data);
+    free(data.order);
+    free(data.slot);
+    free(data.bodies);
+    return buf;
+}
+
+// frames with and without --reorder: same bodies in the same order, same trajectories
+double reorder_check(int K) {
+    size_t size0, size1;
+    char* buf0 = reorder_frames(0, &size0);
+    char* buf1 = reorder_frames(K, &size1);
+    struct traj_reader r0, r1;
+    double err = INFINITY;
+    if (traj_open(&r0, buf0, size0) == 0 && traj_open(&r1, buf1, size1) == 0 && r0.nframes == r1.nframes && r0.nframes > 1) {
+        int n = r0.nbodies;
+        double* rv0 = malloc(6 * n * sizeof(double));
+        double* rv1 = malloc(6 * n * sizeof(double));
+        double t0, t1;
+        err = 0;
+        for (int i = 0; i < n; i++) {
+            err = fmax(err, fabs(r0.bodies[i].m - r1.bodies[i].m));
+        }
+        for (long k = 0; k < r0.nframes; k++) {
+            traj_read_frame(&r0, k, &t0, rv0);
+            traj_read_frame(&r1, k, &t1, rv1);
+            err = fmax(err, fabs(t0 - t1));
+            for (int i = 0; i < 6 * n; i++) {
+                err = fmax(err, fabs(rv0[i] - rv1[i]) / (i % 6 < 3 ? 1 : sqrt(1e5)));
+            }
+        }
+        free(rv0);
+        free(rv1);
+        traj_close(&r1);
+        traj_close(&r0);
+    }
+    free(buf0);
+    free(buf1);
+    return err;
+}
+
+// interpolation inside a step of a circular orbit against the exact one
+double dense_check(int quintic) {
+    double M = 1e5, h = 1e-3;
+    double w = sqrt(M);
+    double max_err = 0;
+    double r0[3], v0[3], a0[3], r1[3], v1[3], a1[3], r[3], v[3];
+    for (int e = 0; e < 2; e++) {
+        double* rr = e ? r1 : r0;
+        double* vv = e ? v1 : v0;
+        double* aa = e ? a1 : a0;
+        double t = e * h;
+        rr[0] = cos(w * t); rr[1] = sin(w * t); rr[2] = 0;
+        vv[0] = -w * sin(w * t); vv[1] = w * cos(w * t); vv[2] = 0;
+        aa[0] = -w * w * cos(w * t); aa[1] = -w * w * sin(w * t); aa[2] = 0;
+    }
+    for (int i = 0; i <= 16; i++) {
+        double s = i / 16.0;
+        dense_interpolate(r0, v0, quintic ? a0 : NULL, r1, v1, quintic ? a1 : NULL, h, s, r, v);
+        max_err = fmax(max_err, fabs(r[0] - cos(w * s * h)) + fabs(r[1] - sin(w * s * h)));
+        max_err = fmax(max_err, (fabs(v[0] + w * sin(w * s * h)) + fabs(v[1] - w * cos(w * s * h))) / w);
+    }
+    return max_err;
+}
+
+/*
+  two planets and a ring of test particles around a fixed star: the planets
+  move exactly as without the ring, the particles keep near their orbits
+ */
+double test_particles_check(double* ring_err) {
+    int np = 3, nring = 64, n = np + nring;
+    struct body* bodies = calloc(n, sizeof(struct body));
+    struct body* alone = calloc(np, sizeof(struct body));
+    double M = 1e5;
+    for (int i = 0; i < n; i++) {
+        double R = i == 0 ? 0 : i < np ? 1 + i : 1 + 0.01 * (i - np) / nring;
+        double phi = 2 * M_PI * i / n;
+        double v = R > 0 ? sqrt(M / R) : 0;
+        bodies[i] = (struct body) {
+            .r = {R * cos(phi), R * sin(phi), 0},
+            .v = {-v * sin(phi), v * cos(phi), 0},
+            .m = i == 0 ? M : i < np ? 10 : 1e-3,
+            .fixed = i == 0,
+            .min_rad = -1, .max_rad = -1
+        };
+    }
+    memcpy(alone, bodies, np * sizeof(struct body));
+
+    struct data data = {.nbodies = n, .bodies = bodies, .G = 1, .dt = 1e-5, .test_mass = 1e-3};
+    struct data ref = {.nbodies = np, .bodies = alone, .G = 1, .dt = 1e-5};
+    verlet_init(&data);
+    verlet_init(&ref);
+    for (int s = 0; s < 2000; s++) {
+        verlet_next(&data);
+        verlet_next(&ref);
+    }
+    double err = 0;
+    for (int i = 0; i < np; i++) {
+        for (int k = 0; k < 3; k++) {
+            err = fmax(err, fabs(bodies[i].r[k] - alone[i].r[k]) + fabs(bodies[i].v[k] - alone[i].v[k]));
+        }
+    }
+    *ring_err = 0;
+    for (int i = np; i < n; i++) {
+        double R0 = 1 + 0.01 * (i - np) / nring;
+        double* r = bodies[i].r;
+        *ring_err = fmax(*ring_err, fabs(sqrt(r[0] * r[0] + r[1] * r[1]) - R0));
+    }
+    free(data.massive);
+    free(ref.massive);
+    pool_free(&data);
+    pool_free(&ref);
+    free(bodies);
+    free(alone);
+    return err;
+}
 
-            for (int k = 0; k < 3; k++) {
-                b1->a_next[k] += G * b2->m * (b2->r[k] - b1->r[k]) / R / R / R;
-            }
+// symmetric threaded pass against the plain sum over ordered pairs
+double pair_check(int nthreads) {
+    int n = 700;
+    struct body* bodies = calloc(n, sizeof(struct body));
+    unsigned seed = 7;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            bodies[i].r[k] = (double)rand_r(&seed) / RAND_MAX - 0.5;
         }
+        bodies[i].m = i % 5 == 0 ? 0 : 1 + 0.1 * (i % 7);
+        bodies[i].fixed = i % 11 == 0;
+        bodies[i].a_next[0] = i;
     }
+    struct data data = {.nbodies = n, .bodies = bodies, .G = 1, .threads = nthreads};
+    accel(&data);
 
+    double max_err = 0;
     for (int i = 0; i < n; i++) {
-        struct body* b = &data->bodies[i];
-
+        struct body* b1 = &bodies[i];
+        double a[3] = {0, 0, 0};
+        for (int j = 0; j < n; j++) {
+            struct body* b2 = &bodies[j];
+            if (i == j || b2->m <= 0) continue;
+            double R = sqrt((b2->r[0] - b1->r[0]) * (b2->r[0] - b1->r[0])
+                + (b2->r[1] - b1->r[1]) * (b2->r[1] - b1->r[1])
+                + (b2->r[2] - b1->r[2]) * (b2->r[2] - b1->r[2]));
+            for (int k = 0; k < 3; k++) {
+                a[k] += b2->m * (b2->r[k] - b1->r[k]) / R / R / R;
+            }
+        }
+        if (b1->fixed) {
+            // untouched
+            a[0] = i; a[1] = a[2] = 0;
+        }
         for (int k = 0; k < 3; k++) {
-            // new vel
-            b->v[k] = b->v[k] + 0.5 * dt * (b->a[k] + b->a_next[k]);
-            // a = new acc
-            b->a[k] = b->a_next[k];
+            max_err = fmax(max_err, fabs(b1->a_next[k] - a[k]) / (fabs(a[k]) + 1));
         }
     }
+    free(data.massive);
+    pool_free(&data);
+    free(bodies);
+    return max_err;
 }
 
-double kepler(double dt) {
-    double G = 1;
-    double MM = 1e5;
+void run_test() {
+    double pair1 = pair_check(1);
+    double pair3 = pair_check(3);
+    printf("%e %e\n", pair1, pair3);
+    if (pair1 > 1e-10 || pair3 > 1e-10) {
+        printf("Error9\n");
+        exit(9);
+    }
 
-    struct body bodies[] = {
-        {
-            .r = {0, 0, 0},
-            .v = {0, 0, 0},
-            .a = {0, 0, 0},
-            .m = MM,
-            .fixed = 1
-        },
-        {
-            .r = {0, 1, 0},
-            .v = {sqrt(G * MM), 0, 0},
-            .a = {0, 0, 0},
-            .m = 1,
-            .fixed = 0
-        },
-    };
+    double orbit_err;
+    double tp_err = test_particles_check(&orbit_err);
+    printf("%e %e\n", tp_err, orbit_err);
+    if (tp_err != 0 || orbit_err > 1e-3) {
+        printf("Error8\n");
+        exit(8);
+    }
 
-    struct data data = {
-        .nbodies = 2,
-        .bodies = &bodies[0],
-        .G = G,
-        .dt = dt
-    };
+    double dense5 = dense_check(1);
+    double dense3 = dense_check(0);
+    printf("%e %e\n", dense5, dense3);
+    if (dense5 > 1e-6 || dense3 > 1e-3 || dense5 > dense3) {
+        printf("Error7\n");
+        exit(7);
+    }
 
-    double max_err = 0;
+    double period_err;
+    double ev_err = events_check(&period_err);
+    printf("%e %e\n", ev_err, period_err);
+    // Verlet's own error is 2e-6 at this dt, stopping at the step would give 1e-4
+    if (ev_err > 1e-5 || period_err > 1e-5) {
+        printf("Error6\n");
+        exit(6);
+    }
 
-    verlet_init(&data);
+    // must converge before the trivial slices-th iteration
+    struct parareal p = {.slices = 8, .steps = 500, .ratio = 20, .tol = 1e-10};
+    double pr_err = parareal_check(&p);
+    printf("%e %d\n", pr_err, p.iterations);
+    if (pr_err > 1e-9 || p.iterations >= p.slices) {
+        printf("Error5\n");
+        exit(5);
+    }
 
-    double T = 0.1;
-    double t = 0;
-    while (t < T) {
-        verlet_next(&data);
+    // a tight binary: KS keeps the energy, Verlet at the same step does not
+    double ks_err = ks_check(METHOD_KS, 1e-3, 0.1);
+    double ks_same = ks_check(METHOD_VERLET, 1e-3, 0.1);
+    printf("%e %e\n", ks_err, ks_same);
+    if (ks_err > 1e-5 || ks_err * 100 > ks_same) {
+        printf("Error4\n");
+        exit(4);
+    }
 
-        double r = 0;
-        for (int k = 0; k < 3; k++) {
-            r += data.bodies[1].r[k] * data.bodies[1].r[k];
-        }
-        r = sqrt(r);
-        double err = fabs(r - 1.0);
-        if (max_err < err) {
-            max_err = err;
-        }
-	t += dt;
+    double reorder_err = reorder_check(4);
+    printf("%e\n", reorder_err);
+    if (reorder_err > 1e-9) {
+        printf("Error10\n");
+        exit(10);
+    }
+
+    double ring_err = ring_check(100);
+    printf("%e\n", ring_err);
+    if (ring_err > 1e-9) {
+        printf("Error3\n");
+        exit(3);
+    }
+
+    static char single_events[16384], ring_events3[16384];
+    int nsingle = ring_events(1, single_events, sizeof(single_events));
+    int nring = ring_events(3, ring_events3, sizeof(ring_events3));
+    printf("%d %d\n", nsingle, nring);
+    if (nsingle == 0 || nsingle != nring || strcmp(single_events, ring_events3)) {
+        printf("Error11\n");
+        exit(11);
     }
-    return max_err;
-}
 
-void run_test() {
     double err1 = kepler(0.001);
     double err2 = kepler(0.0001);
     double err3 = kepler(0.00001);
@@ -194,6 +1675,28 @@ void run_test() {
     exit(0);
 }
 
+int load_binary(struct data* data, const char* fn) {
+    struct ic_body* src;
+    int ret = ic_read(fn, &data->G, &data->nbodies, &src);
+    if (ret <= 0) {
+        return ret;
+    }
+    data->bodies = calloc(data->nbodies, sizeof(struct body));
+    for (int i = 0; i < data->nbodies; i++) {
+        struct body* b = &data->bodies[i];
+        strcpy(b->name, src[i].name);
+        strcpy(b->color, src[i].color);
+        memcpy(b->r, src[i].r, sizeof(b->r));
+        memcpy(b->v, src[i].v, sizeof(b->v));
+        b->m = src[i].m;
+        b->min_rad = src[i].min_rad;
+        b->max_rad = src[i].max_rad;
+        b->rad = src[i].rad;
+    }
+    free(src);
+    return 1;
+}
+
 /*
   file format:
   G
@@ -202,9 +1705,18 @@ void run_test() {
   Body2 r0 r1 r2 v0 v1 v2 Mass
   ...
   BodyN r0 r1 r2 v0 v1 v2 Mass
+  or the binary format of ic.h
  */
 
-void load(struct data* data, const char* fn) {
+int load_file(struct data* data, const char* fn) {
+    int binary = load_binary(data, fn);
+    if (binary < 0) {
+        fprintf(stderr, "Cannot open or parse file: '%s'\n", fn);
+        return -1;
+    } else if (binary) {
+        return 0;
+    }
+
     FILE* f = fopen(fn, "rb");
     if (!f) { goto err; }
 
@@ -232,6 +1744,7 @@ void load(struct data* data, const char* fn) {
     double min_radius, max_radius;
     double rad;
     while (fscanf(f, "%d %10s %lf %lf %lf", &i, color, &min_radius, &max_radius, &rad) == 5) {   
+        if (i < 0 || i >= data->nbodies) { goto err; }
         strcpy(data->bodies[i].color, color);
         data->bodies[i].min_rad = min_radius;
         data->bodies[i].max_rad = max_radius;
@@ -240,11 +1753,20 @@ void load(struct data* data, const char* fn) {
 
     fclose(f);
 
-    return;
+    return 0;
 
 err:
     fprintf(stderr, "Cannot open or parse file: '%s'\n", fn);
-    exit(1);
+    if (f) { fclose(f); }
+    free(data->bodies);
+    data->bodies = NULL;
+    return -1;
+}
+
+void load(struct data* data, const char* fn) {
+    if (load_file(data, fn) < 0) {
+        exit(1);
+    }
 }
 
 void print_header(struct data* data) {
@@ -261,35 +1783,589 @@ void print_header(struct data* data) {
     printf("\n");
     // comment
     for (int i = 0; i < data->nbodies; i++) {
-        printf("# %s %le %s %lf\n", data->bodies[i].name, data->bodies[i].m, data->bodies[i].color, data->bodies[i].rad);
+        struct body* b = body_at(data, i);
+        printf("# %s %le %s %lf\n", b->name, b->m, b->color, b->rad);
+    }
+}
+
+/*
+  frame of a viewer: "v t a [r v of body a] i r i r ...", the full state of
+  the active body a (-1 for none) and positions of the bodies inside the box
+  x0 y0 x1 y1 in the xy plane with view_digits significant digits
+ */
+void print_view(struct data* data, double t) {
+    int a = data->view_active < data->nbodies ? data->view_active : -1;
+    int p = data->view_digits - 1;
+    double* box = data->view_box;
+    printf("v %e %d ", t, a);
+    if (a >= 0) {
+        struct body* b = body_at(data, a);
+        printf("%e %e %e %e %e %e ", b->r[0], b->r[1], b->r[2], b->v[0], b->v[1], b->v[2]);
+    }
+    for (int i = 0; i < data->nbodies; i++) {
+        double* r = body_at(data, i)->r;
+        if (i != a && r[0] >= box[0] && r[0] <= box[2] && r[1] >= box[1] && r[1] <= box[3]) {
+            printf("%d %.*e %.*e %.*e ", i, p, r[0], p, r[1], p, r[2]);
+        }
     }
+    printf("\n");
 }
 
 void print(struct data* data, double t) {
+    if (data->view) {
+        print_view(data, t);
+        return;
+    }
     printf("%e ", t);
     for (int i = 0; i < data->nbodies; i++) {
-        printf(
-            "%e %e %e %e %e %e ",
-            data->bodies[i].r[0], data->bodies[i].r[1], data->bodies[i].r[2],
-            data->bodies[i].v[0], data->bodies[i].v[1], data->bodies[i].v[2]);
+        struct body* b = body_at(data, i);
+        printf("%e %e %e %e %e %e ", b->r[0], b->r[1], b->r[2], b->v[0], b->v[1], b->v[2]);
     }
     printf("\n");
 }
 
+void open_traj(struct data* data, const char* fn, double err_r, double err_v) {
+    struct traj_body* bodies = calloc(data->nbodies, sizeof(struct traj_body));
+    for (int i = 0; i < data->nbodies; i++) {
+        strcpy(bodies[i].name, data->bodies[i].name);
+        strncpy(bodies[i].color, data->bodies[i].color, sizeof(bodies[i].color) - 1);
+        bodies[i].m = data->bodies[i].m;
+        bodies[i].rad = data->bodies[i].rad;
+    }
+    data->traj = calloc(1, sizeof(struct traj_writer));
+    if (traj_writer_open(data->traj, fn, data->nbodies, bodies, err_r, err_v, TRAJ_CHUNK_FRAMES) < 0) {
+        fprintf(stderr, "Cannot create file: '%s'\n", fn);
+        exit(1);
+    }
+    data->traj_buf = calloc(6 * data->nbodies, sizeof(double));
+    free(bodies);
+}
+
+void close_traj(struct data* data) {
+    if (data->traj) {
+        traj_writer_close(data->traj);
+        free(data->traj);
+        free(data->traj_buf);
+        data->traj = NULL;
+        data->traj_buf = NULL;
+    }
+}
+
+void open_events(struct data* data, double close, double collide, double escape) {
+    double* m = calloc(data->nbodies, sizeof(double));
+    char (*names)[16] = calloc(data->nbodies, 16);
+    for (int i = 0; i < data->nbodies; i++) {
+        m[i] = data->bodies[i].m;
+        strcpy(names[i], data->bodies[i].name);
+    }
+    data->events = calloc(1, sizeof(struct events));
+    events_init(data->events, stdout, data->nbodies, m);
+    data->events->close = close;
+    data->events->collide = collide;
+    data->events->escape = escape;
+    events_header(data->events, names);
+    if (!data->traj_buf) {
+        data->traj_buf = calloc(6 * data->nbodies, sizeof(double));
+    }
+    free(m);
+    free(names);
+}
+
+void close_events(struct data* data) {
+    if (data->events) {
+        fprintf(stderr, "events: %ld\n", data->events->count);
+        events_free(data->events);
+        free(data->events);
+        data->events = NULL;
+        if (!data->traj) {
+            free(data->traj_buf);
+            data->traj_buf = NULL;
+        }
+    }
+}
+
+void output(struct data* data, double t) {
+    if (data->dist) {
+        ring_gather(data);
+        if (data->dist->ring.rank != 0) {
+            return;
+        }
+    }
+    if (!data->traj) {
+        print(data, t);
+        return;
+    }
+    double* rv = data->traj_buf;
+    for (int i = 0; i < data->nbodies; i++) {
+        struct body* b = body_at(data, i);
+        for (int k = 0; k < 3; k++) {
+            rv[6*i+k] = b->r[k];
+            rv[6*i+3+k] = b->v[k];
+        }
+    }
+    traj_write_frame(data->traj, t, rv);
+}
+
+// events see every step, whatever the frame schedule is; every rank takes part in the gather
+void observe(struct data* data, double t) {
+    if (data->dist) {
+        ring_gather(data);
+        if (data->dist->ring.rank != 0) {
+            return;
+        }
+    }
+    double* rv = data->traj_buf;
+    for (int i = 0; i < data->nbodies; i++) {
+        struct body* b = body_at(data, i);
+        for (int k = 0; k < 3; k++) {
+            rv[6*i+k] = b->r[k];
+            rv[6*i+3+k] = b->v[k];
+        }
+    }
+    events_step(data->events, t, rv);
+}
+
+void save_step(struct data* data) {
+    int lo = data->dist ? data->dist->lo : 0;
+    int hi = data->dist ? data->dist->hi : data->nbodies;
+    if (data->dense_n != data->nbodies) {
+        data->dense_n = data->nbodies;
+        data->dense = realloc(data->dense, 15 * data->nbodies * sizeof(double));
+    }
+    for (int i = lo; i < hi; i++) {
+        double* d = &data->dense[9 * i];
+        memcpy(d, data->bodies[i].r, 3 * sizeof(double));
+        memcpy(d + 3, data->bodies[i].v, 3 * sizeof(double));
+        memcpy(d + 6, data->bodies[i].a, 3 * sizeof(double));
+    }
+}
+
+// frame at tau inside the step that ended at t
+void dense_output(struct data* data, double t, double tau) {
+    int lo = data->dist ? data->dist->lo : 0;
+    int hi = data->dist ? data->dist->hi : data->nbodies;
+    double h = data->dt;
+    double s = 1 - (t - tau) / h;
+    double* end = &data->dense[9 * data->nbodies];
+    for (int i = lo; i < hi; i++) {
+        struct body* b = &data->bodies[i];
+        double* d = &data->dense[9 * i];
+        double* e = &end[6 * i];
+        memcpy(e, b->r, 3 * sizeof(double));
+        memcpy(e + 3, b->v, 3 * sizeof(double));
+        // Euler leaves the acceleration of the start of the step in a
+        int quintic = data->method != METHOD_EULER;
+        dense_interpolate(d, d + 3, quintic ? d + 6 : NULL, e, e + 3, quintic ? b->a : NULL, h, s, b->r, b->v);
+    }
+    output(data, tau);
+    for (int i = lo; i < hi; i++) {
+        memcpy(data->bodies[i].r, &end[6 * i], 3 * sizeof(double));
+        memcpy(data->bodies[i].v, &end[6 * i + 3], 3 * sizeof(double));
+    }
+}
+
+void schedule(struct data* data, double t) {
+    if (data->output_dt > 0) {
+        while ((data->output_n + 1) * data->output_dt <= t) {
+            data->output_n++;
+            dense_output(data, t, data->output_n * data->output_dt);
+        }
+    } else if (data->output_every > 0 && ++data->step % data->output_every == 0) {
+        output(data, t);
+    }
+}
+
+void pace_reset(struct data* data, double t) {
+    data->pace_t = t;
+    data->pace_sec = now_sec();
+}
+
+// with a rate set the kernel keeps to the clock of the viewer instead of filling the pipe
+void pace(struct data* data, double t) {
+    if (data->rate <= 0) {
+        return;
+    }
+    double ahead = (t - data->pace_t) / data->rate - (now_sec() - data->pace_sec);
+    if (ahead < -0.1) {
+        // behind, do not rush to catch up
+        pace_reset(data, t);
+    } else if (ahead > 0) {
+        // frames are due now, commands wake us up
+        fflush(stdout);
+        struct pollfd fd = {.fd = 0, .events = POLLIN};
+        poll(&fd, 1, (int)(ahead * 1000));
+    }
+}
+
+int method_by_name(const char* name) {
+    return !strcmp(name, "euler") ? METHOD_EULER
+        : !strcmp(name, "ks") ? METHOD_KS
+        : METHOD_VERLET;
+}
+
+/*
+  commands, one per line, applied between steps:
+  pause
+  resume
+  dt 0.001
+  method euler|verlet|ks
+  perturb i dx dy dz dvx dvy dvz
+  reload file.txt
+  view x0 y0 x1 y1 active digits
+  view off
+  test_mass 0.01    bodies up to this mass attract nothing, as --test-mass
+  rate 0.5          simulated time per second, 0: as fast as possible
+  output 0.01       frame interval in simulated time, 0: every step
+  quit
+ */
+void command(struct data* data, char* line, double* t) {
+    char arg[256];
+    double d[6];
+    int i;
+    if (!strcmp(line, "pause")) {
+        data->paused = 1;
+    } else if (!strcmp(line, "resume")) {
+        data->paused = 0;
+        pace_reset(data, *t);
+    } else if (!strcmp(line, "quit")) {
+        exit(0);
+    } else if (sscanf(line, "dt %lf", &d[0]) == 1 && d[0] > 0) {
+        data->dt = d[0];
+    } else if (sscanf(line, "method %255s", arg) == 1) {
+        int method = method_by_name(arg);
+        if (method != METHOD_EULER && data->method == METHOD_EULER) {
+            verlet_init(data);
+        }
+        data->method = method;
+    } else if (sscanf(line, "perturb %d %lf %lf %lf %lf %lf %lf", &i, &d[0], &d[1], &d[2], &d[3], &d[4], &d[5]) == 7
+               && i >= 0 && i < data->nbodies)
+    {
+        struct body* b = body_at(data, i);
+        for (int k = 0; k < 3; k++) {
+            b->r[k] += d[k];
+            b->v[k] += d[3 + k];
+        }
+        if (data->method != METHOD_EULER) {
+            verlet_init(data);
+        }
+    } else if (sscanf(line, "test_mass %lf", &d[0]) == 1) {
+        data->test_mass = d[0];
+        find_massive(data);
+        if (data->method != METHOD_EULER) {
+            verlet_init(data);
+        }
+    } else if (sscanf(line, "rate %lf", &d[0]) == 1 && d[0] >= 0) {
+        data->rate = d[0];
+        pace_reset(data, *t);
+    } else if (sscanf(line, "output %lf", &d[0]) == 1 && d[0] >= 0) {
+        data->output_dt = d[0];
+        data->output_every = 1;
+        data->output_n = d[0] > 0 ? (long)(*t / d[0]) : 0;
+    } else if (!strcmp(line, "view off")) {
+        data->view = 0;
+    } else if (sscanf(line, "view %lf %lf %lf %lf %d %d", &d[0], &d[1], &d[2], &d[3], &data->view_active, &i) == 6) {
+        memcpy(data->view_box, d, sizeof(data->view_box));
+        data->view_digits = i < 1 ? 1 : (i > 17 ? 17 : i);
+        data->view = 1;
+    } else if (sscanf(line, "reload %255s", arg) == 1) {
+        struct data next = {0};
+        if (data->traj || data->events) {
+            // an archive has a fixed set of bodies and increasing times
+            fprintf(stderr, "Cannot reload '%s' while writing --traj or --events\n", arg);
+        } else if (load_file(&next, arg) == 0) {
+            free(data->bodies);
+            data->bodies = next.bodies;
+            data->nbodies = next.nbodies;
+            data->G = next.G;
+            free(data->massive);
+            pool_free(data);
+            free(data->order);
+            free(data->slot);
+            data->massive = NULL;
+            data->order = data->slot = NULL;
+            *t = 0;
+            data->output_n = data->step = 0;
+            pace_reset(data, *t);
+            print_header(data);
+            output(data, *t);
+            verlet_init(data);
+        }
+    } else if (*line) {
+        fprintf(stderr, "Unknown command: '%s'\n", line);
+    }
+}
+
+void poll_commands(struct data* data, double* t) {
+    for (;;) {
+        struct pollfd fd = {.fd = 0, .events = POLLIN};
+        if (data->paused) {
+            fflush(stdout);
+        }
+        if (poll(&fd, 1, data->paused ? -1 : 0) <= 0) {
+            return;
+        }
+        ssize_t n = read(0, data->cmd + data->cmd_len, sizeof(data->cmd) - 1 - data->cmd_len);
+        if (n <= 0) {
+            // nobody to talk to anymore
+            data->control = data->paused = 0;
+            return;
+        }
+        data->cmd_len += n;
+        data->cmd[data->cmd_len] = 0;
+
+        char* line = data->cmd;
+        char* end;
+        while ((end = strchr(line, '\n'))) {
+            *end = 0;
+            command(data, line, t);
+            line = end + 1;
+        }
+        data->cmd_len -= line - data->cmd;
+        memmove(data->cmd, line, data->cmd_len);
+        if (data->cmd_len == sizeof(data->cmd) - 1) {
+            data->cmd_len = 0;
+        }
+        if (!data->paused) {
+            return;
+        }
+    }
+}
+
+void parareal_solve(struct data* data, double T) {
+    struct parareal* p = data->parareal;
+    int m = 6 * data->nbodies;
+    double* U = calloc((p->slices + 1) * m, sizeof(double));
+    double t = 0;
+    double slice = data->dt * p->steps;
+
+    if (!data->traj) {
+        print_header(data);
+    }
+    output(data, t);
+    pack(data->bodies, data->nbodies, U);
+    while (t < T) {
+        parareal_window(data, U);
+        for (int n = 1; n <= p->slices; n++) {
+            unpack(data->bodies, data->nbodies, &U[n * m]);
+            output(data, t + n * slice);
+        }
+        t += p->slices * slice;
+        memcpy(U, &U[p->slices * m], m * sizeof(double));
+    }
+    free(U);
+
+    fprintf(stderr, "parareal: %d windows, %.2f iterations per window, speedup %.2f\n",
+        p->windows, (double)p->iterations / p->windows, p->fine_sec / p->wall_sec);
+}
+
+void kernel_next(struct data* data) {
+    if (data->method == METHOD_EULER) {
+        euler_next(data);
+    } else if (data->method == METHOD_KS) {
+        ks_next(data);
+    } else {
+        verlet_next(data);
+    }
+}
+
 void solve(struct data* data, double T) {
     double t = 0;
-    print_header(data);
-    print(data, t);
+    int frames = data->output_every > 0 || data->output_dt > 0;
+    if (frames && !data->traj && (!data->dist || data->dist->ring.rank == 0)) {
+        print_header(data);
+    }
+    if (frames) {
+        output(data, t);
+    }
+    if (data->observing) {
+        observe(data, t);
+    }
     verlet_init(data);
+    long steps = 0;
+    double start = now_sec();
     while (t < T) {
-        verlet_next(data);
+        if (data->control) {
+            pace(data, t);
+            poll_commands(data, &t);
+        }
+        if (data->reorder > 0 && steps % data->reorder == 0) {
+            reorder(data);
+        }
+        if (data->output_dt > 0) {
+            save_step(data);
+        }
+        kernel_next(data);
         t += data->dt;
-        print(data, t);
+        steps++;
+        if (data->observing) {
+            observe(data, t);
+        }
+        schedule(data, t);
+    }
+    if (!data->control && !data->dist && steps > 0) {
+        fprintf(stderr, "%ld steps, %.3e interactions/s\n",
+            steps, steps * (double)data->nbodies * data->nmassive / (now_sec() - start));
+    }
+}
+
+/*
+  Calibration: the fastest settings of the force pass are measured once per
+  machine and size of the problem and kept in a text file, one line per
+  key: log2 N <tab> settings <tab> CPU model. Trials run short on at most
+  TUNE_BODIES bodies of the input and compare interactions per second.
+  Each trial is repeated TUNE_REPEAT times and the median is taken, a
+  candidate replaces the first (default) one only if it is faster by
+  more than TUNE_MARGIN, so noise does not flip the settings.
+ */
+#define TUNE_BODIES 8192
+#define TUNE_REPEAT 3
+#define TUNE_MARGIN 1.1
+
+struct tune {
+    int reorder;
+    int threads;    // 0 for all cores
+};
+
+// the reorder interval does not change the work of the direct sum, only the threads are tried;
+// lines cached by older versions may still carry a reorder
+static const struct tune tune_candidates[] = {{0, 1}, {0, 0}};
+
+void cpu_model(char* model, int size) {
+    char line[256];
+    snprintf(model, size, "unknown");
+    FILE* f = fopen("/proc/cpuinfo", "rb");
+    if (!f) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char* p = strchr(line, ':');
+        if (p && !strncmp(line, "model name", 10)) {
+            p += strspn(p + 1, " ") + 1;
+            p[strcspn(p, "\r\n")] = 0;
+            snprintf(model, size, "%s", p);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+double tune_trial(struct data* data, const struct tune* c) {
+    int n = data->nbodies < TUNE_BODIES ? data->nbodies : TUNE_BODIES;
+    struct data trial = {
+        .nbodies = n,
+        .bodies = malloc(n * sizeof(struct body)),
+        .G = data->G,
+        .dt = data->dt,
+        .method = data->method,
+        .ks_radius = data->ks_radius,
+        .test_mass = data->test_mass,
+        .reorder = c->reorder,
+        .threads = c->threads > 0 ? c->threads : sysconf(_SC_NPROCESSORS_ONLN)
+    };
+    memcpy(trial.bodies, data->bodies, n * sizeof(struct body));
+    verlet_init(&trial);
+    long steps = 0;
+    double start = now_sec();
+    double sec;
+    do {
+        if (trial.reorder > 0 && steps % trial.reorder == 0) {
+            reorder(&trial);
+        }
+        kernel_next(&trial);
+        steps++;
+        sec = now_sec() - start;
+    } while (sec < 0.2 && steps < 1000);
+    double rate = steps * (double)n * trial.nmassive / sec;
+    free(trial.ks_partner);
+    free(trial.ks_r0);
+    free(trial.ks_pairs);
+    free(trial.massive);
+    pool_free(&trial);
+    free(trial.order);
+    free(trial.slot);
+    free(trial.bodies);
+    return rate;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+double tune_median(struct data* data, const struct tune* c) {
+    double rate[TUNE_REPEAT];
+    for (int k = 0; k < TUNE_REPEAT; k++) {
+        rate[k] = tune_trial(data, c);
+    }
+    qsort(rate, TUNE_REPEAT, sizeof(double), cmp_double);
+    return rate[TUNE_REPEAT / 2];
+}
+
+void autotune(struct data* data, const char* fn) {
+    char model[200], line[512], key_model[200];
+    int bucket = (int)log2(data->nbodies + 1);
+    struct tune best = tune_candidates[0];
+    int key, found = 0;
+    cpu_model(model, sizeof(model));
+
+    FILE* f = fopen(fn, "rb");
+    while (f && fgets(line, sizeof(line), f)) {
+        struct tune c;
+        line[strcspn(line, "\r\n")] = 0;
+        // lines written before the threads knob mean one thread
+        int fields = sscanf(line, "%d\treorder=%d threads=%d\t%199[^\n]", &key, &c.reorder, &c.threads, key_model);
+        if (fields != 4) {
+            c.threads = 1;
+            fields = 1 + sscanf(line, "%d\treorder=%d\t%199[^\n]", &key, &c.reorder, key_model);
+        }
+        if (fields == 4 && key == bucket && !strcmp(key_model, model)) {
+            best = c;
+            found = 1;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+
+    // nothing to try on one core
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!found && ncpu > 1) {
+        double best_rate = 0;
+        for (int i = 0; i < sizeof(tune_candidates) / sizeof(tune_candidates[0]); i++) {
+            const struct tune* c = &tune_candidates[i];
+            double rate = tune_median(data, c);
+            fprintf(stderr, "autotune: reorder=%d threads=%d %.3e interactions/s\n", c->reorder, c->threads, rate);
+            if (i == 0) {
+                best_rate = rate * TUNE_MARGIN;
+            } else if (rate > best_rate) {
+                best_rate = rate;
+                best = tune_candidates[i];
+            }
+        }
+        f = fopen(fn, "ab");
+        if (f) {
+            fprintf(f, "%d\treorder=%d threads=%d\t%s\n", bucket, best.reorder, best.threads, model);
+            fclose(f);
+        } else {
+            fprintf(stderr, "Cannot write calibration file: '%s'\n", fn);
+        }
     }
+    fprintf(stderr, "autotune: reorder=%d threads=%d (%s, N bucket %d, %s)\n",
+        best.reorder, best.threads, found ? "cached" : ncpu > 1 ? "measured" : "one core", bucket, model);
+    data->reorder = best.reorder;
+    data->threads = best.threads > 0 ? best.threads : ncpu;
 }
 
 void usage(const char* name) {
-    fprintf(stderr, "%s --input file.txt [--dt 0.001] [--T 10] [--test]\n", name);
+    fprintf(stderr,
+            "%s --input file.txt [--dt 0.001] [--T 10] [--traj out.nbt] [--traj-err 1e-6] [--traj-err-v 1e-6] [--test]\n"
+            "    [--method euler|verlet|ks] [--ks-radius R] [--test-mass m] [--reorder K] [--control [--rate R]]\n"
+            "    [--threads T] [--autotune] [--calibration calibration.txt]\n"
+            "    [--parareal P] [--parareal-steps S] [--parareal-ratio R] [--parareal-tol 1e-10]\n"
+            "    [--events] [--events-close R] [--events-collide R] [--events-escape R]\n"
+            "    [--output-dt dt | --output-every K]\n"
+            "    [--ring-local P | --ring-size P --ring-rank k --ring-listen addr --ring-next addr]\n"
+            "    addr: unix:/path or host:port\n", name);
     exit(0);
 }
 
@@ -298,6 +2374,28 @@ int main(int argc, char** argv) {
     double dt = 0.0001;
     double T = 10.0;
     int test_mode = 0;
+    const char* traj_fn = NULL;
+    double traj_err = 1e-6;
+    double traj_err_v = -1;
+    int method = METHOD_VERLET;
+    double ks_radius = 0.2;
+    double test_mass = 0;
+    int reorder = -1; // -1 if not given, explicit options win over --autotune
+    int tune = 0;
+    int threads = -1;
+    const char* calibration = "calibration.txt";
+    int events = 0;
+    int output_every = -1;
+    double output_dt = 0;
+    double rate = 0;
+    double events_close = 0, events_collide = 0, events_escape = 0;
+    struct parareal parareal = {.steps = 1000, .ratio = 20, .tol = 1e-10};
+    int control = 0;
+    int ring_local = 0;
+    int ring_size = 1;
+    int ring_rank = 0;
+    const char* ring_listen = NULL;
+    const char* ring_next = NULL;
     for (int i = 1; i < argc; i++) {
         if (i < argc - 1 && !strcmp(argv[i], "--input")) {
             fn = argv[++i];
@@ -305,6 +2403,60 @@ int main(int argc, char** argv) {
             dt = atof(argv[++i]);
         } else if (i < argc - 1 && !strcmp(argv[i], "--T")) {
             T = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--traj")) {
+            traj_fn = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--traj-err")) {
+            traj_err = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--traj-err-v")) {
+            traj_err_v = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--method")) {
+            method = method_by_name(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--parareal")) {
+            parareal.slices = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--parareal-steps")) {
+            parareal.steps = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--parareal-ratio")) {
+            parareal.ratio = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--parareal-tol")) {
+            parareal.tol = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--output-dt")) {
+            output_dt = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--output-every")) {
+            output_every = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--events")) {
+            events = 1;
+        } else if (i < argc - 1 && !strcmp(argv[i], "--events-close")) {
+            events = 1; events_close = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--events-collide")) {
+            events = 1; events_collide = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--events-escape")) {
+            events = 1; events_escape = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--ks-radius")) {
+            ks_radius = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--test-mass")) {
+            test_mass = atof(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--reorder")) {
+            reorder = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--threads")) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--autotune")) {
+            tune = 1;
+        } else if (i < argc - 1 && !strcmp(argv[i], "--calibration")) {
+            tune = 1; calibration = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--rate")) {
+            rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--control")) {
+            control = 1;
+        } else if (i < argc - 1 && !strcmp(argv[i], "--ring-local")) {
+            ring_local = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--ring-size")) {
+            ring_size = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--ring-rank")) {
+            ring_rank = atoi(argv[++i]);
+        } else if (i < argc - 1 && !strcmp(argv[i], "--ring-listen")) {
+            ring_listen = argv[++i];
+        } else if (i < argc - 1 && !strcmp(argv[i], "--ring-next")) {
+            ring_next = argv[++i];
         } else if (!strcmp(argv[i], "--test")) {
             test_mode = 1;
         } else {
@@ -318,10 +2470,83 @@ int main(int argc, char** argv) {
         usage(argv[0]);
     }
 
-    struct data data = {.dt = dt};
+    // with events only the frames asked for explicitly
+    if (output_every < 0) {
+        output_every = events ? 0 : 1;
+    }
+    struct data data = {.dt = dt, .method = method, .ks_radius = ks_radius, .test_mass = test_mass,
+                        .reorder = reorder < 0 ? 0 : reorder, .threads = threads < 1 ? 1 : threads, .output_every = output_every, .output_dt = output_dt};
     load(&data, fn);
-    solve(&data, T);
+    if (tune && ring_local <= 1 && ring_size <= 1) {
+        autotune(&data, calibration);
+        if (reorder >= 0) {
+            data.reorder = reorder;
+        }
+        if (threads > 0) {
+            data.threads = threads;
+        }
+    }
+    if (ring_local > 1) {
+        dist_local(&data, ring_local);
+    } else if (ring_size > 1) {
+        if (!ring_listen || !ring_next) {
+            usage(argv[0]);
+        }
+        dist_init(&data, ring_rank, ring_size, ring_listen, ring_next);
+    }
+    if (data.dist && data.method == METHOD_KS) {
+        fprintf(stderr, "--method ks is not supported in the ring mode\n");
+        exit(1);
+    }
+    if (data.dist && data.reorder > 0) {
+        fprintf(stderr, "--reorder is not supported in the ring mode, ranks own ranges of indices\n");
+        exit(1);
+    }
+    // commands would reach rank 0 only
+    data.control = control && !data.dist;
+    data.rate = rate;
+    if (traj_fn && (!data.dist || data.dist->ring.rank == 0)) {
+        open_traj(&data, traj_fn, traj_err, traj_err_v > 0 ? traj_err_v : traj_err);
+    }
+    if (events && (control || parareal.slices > 0)) {
+        fprintf(stderr, "--events needs every step, it does not work with --control and --parareal\n");
+        exit(1);
+    }
+    data.observing = events;
+    if (events && (!data.dist || data.dist->ring.rank == 0)) {
+        open_events(&data, events_close, events_collide, events_escape);
+    }
+    if (parareal.slices > 0) {
+        if (data.dist || data.method != METHOD_VERLET || control || parareal.steps < 1 || parareal.ratio < 1
+            || output_dt > 0 || output_every != 1)
+        {
+            fprintf(stderr, "--parareal works with --method verlet only, without ring and control modes, frames are slice ends\n");
+            exit(1);
+        }
+        data.parareal = &parareal;
+        parareal_solve(&data, T);
+    } else {
+        solve(&data, T);
+    }
+    close_events(&data);
+    close_traj(&data);
+    dist_free(&data);
+    // rank 0 of --ring-local reaps the forked ranks, the run failed if any of them did
+    int status = 0, child;
+    while (wait(&child) > 0) {
+        if (!WIFEXITED(child) || WEXITSTATUS(child) != 0) {
+            status = 1;
+        }
+    }
+    free(data.ks_partner);
+    free(data.ks_r0);
+    free(data.ks_pairs);
+    free(data.dense);
+    free(data.massive);
+    pool_free(&data);
+    free(data.order);
+    free(data.slot);
     free(data.bodies);
 
-    return 0;
+    return status;
 }